@@ -30,390 +30,4354 @@
 #include <type_traits>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <iterator>
+#include <initializer_list>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <new>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__SSE4_2__))
+#define RS_LAZY_FLAT_SET_SIMD_SCAN
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RS_LAZY_FLAT_SET_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#define RS_LAZY_FLAT_SET_MREMAP
+#endif
 
 namespace rs {
     
 template <class Value, class Less>
 struct LazyFlatSetQuickSort;
 
-template <class Value, class Less = std::less<Value>, class Equal = std::equal_to<Value>, class Sort = LazyFlatSetQuickSort<Value, Less>, class Alloc = std::allocator<Value>, bool IsPointer = false>
-class LazyFlatSet {
-public:
-    template <class T> struct is_shared_ptr : std::false_type {};
-    template <class T> struct is_shared_ptr<std::shared_ptr<T> > : std::true_type {};
-    
-    template <class T> struct is_pointer : std::conditional<IsPointer || std::is_pointer<T>::value || is_shared_ptr<T>::value, std::true_type, std::false_type>::type {};
-    
-    using base_collection = typename std::vector<Value, Alloc>;
-    using size_type = typename base_collection::size_type;
-    using iterator = typename base_collection::iterator;
-    using const_iterator = typename base_collection::const_iterator;
-    using value_type = Value;
-    using value_type_ptr = typename std::conditional<is_pointer<value_type>::value, value_type, value_type*>::type;
-    using reference = typename std::conditional<std::is_fundamental<value_type>::value || std::is_pointer<value_type>::value, value_type, value_type&>::type;
-    using const_reference = typename std::conditional<std::is_fundamental<value_type>::value || std::is_pointer<value_type>::value, value_type, const value_type&>::type;
-    using less_type = Less;
-    using equal_type = Equal;
-    using sort_type = Sort;
-    using alloc_type = Alloc;
-    using compare_type = typename std::function<int(const_reference)>;
-    using erase_type = typename std::function<void(reference)>;
-    
-    enum class insert_hint { no_hint = 0, new_item = 1 };
-    
-    LazyFlatSet(unsigned maxUnsortedEntries = 16, unsigned maxNurseryEntries = 1024) : 
-            maxUnsortedEntries_(maxUnsortedEntries), maxNurseryEntries_(maxNurseryEntries) {
-        unsorted_.reserve(maxUnsortedEntries);
-    }
-    
-    void insert(const value_type& k, insert_hint hint = insert_hint::no_hint) {
-        if (hint == insert_hint::no_hint) {
-            auto iter = lower_bound_equals(coll_, k);
-            if (iter != coll_.end()) {
-                *iter = k;
-            } else {
-                iter = lower_bound_equals(nursery_, k);
-                if (iter != nursery_.end()) {
-                    *iter = k;
-                } else {
-                    iter = search_unsorted(unsorted_, k);
-                    if (iter != unsorted_.end()) {
-                        *iter = k;
-                    } else {
-                        if (unsorted_.size() == maxUnsortedEntries_) {
-                            flushUnsorted();
-                        }
+/**
+ * Vectorized equality scan used on the unsorted tier for arithmetic values compared with
+ * std::equal_to. The instruction set (AVX2 or SSE4.2) is chosen at compile time, eg. with
+ * -mavx2 or -march=native, when neither is available the scan is scalar.
+**/
+struct LazyFlatSetSimdScan {
+#if defined(RS_LAZY_FLAT_SET_SIMD_SCAN) && defined(__AVX2__)
+    using register_type = __m256i;
 
-                        unsorted_.push_back(k);
-                    }
-                }
+    static register_type equal(const void* p, std::int8_t k) { return _mm256_cmpeq_epi8(load(p), _mm256_set1_epi8(k)); }
+    static register_type equal(const void* p, std::int16_t k) { return _mm256_cmpeq_epi16(load(p), _mm256_set1_epi16(k)); }
+    static register_type equal(const void* p, std::int32_t k) { return _mm256_cmpeq_epi32(load(p), _mm256_set1_epi32(k)); }
+    static register_type equal(const void* p, std::int64_t k) { return _mm256_cmpeq_epi64(load(p), _mm256_set1_epi64x(k)); }
+    static register_type equal(const void* p, float k) { return _mm256_castps_si256(_mm256_cmp_ps(_mm256_loadu_ps(static_cast<const float*>(p)), _mm256_set1_ps(k), _CMP_EQ_OQ)); }
+    static register_type equal(const void* p, double k) { return _mm256_castpd_si256(_mm256_cmp_pd(_mm256_loadu_pd(static_cast<const double*>(p)), _mm256_set1_pd(k), _CMP_EQ_OQ)); }
+    static register_type load(const void* p) { return _mm256_loadu_si256(static_cast<const register_type*>(p)); }
+    static unsigned mask(register_type r) { return static_cast<unsigned>(_mm256_movemask_epi8(r)); }
+#elif defined(RS_LAZY_FLAT_SET_SIMD_SCAN)
+    using register_type = __m128i;
+
+    static register_type equal(const void* p, std::int8_t k) { return _mm_cmpeq_epi8(load(p), _mm_set1_epi8(k)); }
+    static register_type equal(const void* p, std::int16_t k) { return _mm_cmpeq_epi16(load(p), _mm_set1_epi16(k)); }
+    static register_type equal(const void* p, std::int32_t k) { return _mm_cmpeq_epi32(load(p), _mm_set1_epi32(k)); }
+    static register_type equal(const void* p, std::int64_t k) { return _mm_cmpeq_epi64(load(p), _mm_set1_epi64x(k)); }
+    static register_type equal(const void* p, float k) { return _mm_castps_si128(_mm_cmpeq_ps(_mm_loadu_ps(static_cast<const float*>(p)), _mm_set1_ps(k))); }
+    static register_type equal(const void* p, double k) { return _mm_castpd_si128(_mm_cmpeq_pd(_mm_loadu_pd(static_cast<const double*>(p)), _mm_set1_pd(k))); }
+    static register_type load(const void* p) { return _mm_loadu_si128(static_cast<const register_type*>(p)); }
+    static unsigned mask(register_type r) { return static_cast<unsigned>(_mm_movemask_epi8(r)); }
+#endif
+
+    // the register lane type matching Value, integers are compared as signed values of the same width
+    template <class Value>
+    struct lane {
+        using type = typename std::conditional<std::is_floating_point<Value>::value, Value,
+            typename std::conditional<sizeof(Value) == 1, std::int8_t,
+            typename std::conditional<sizeof(Value) == 2, std::int16_t,
+            typename std::conditional<sizeof(Value) == 4, std::int32_t, std::int64_t>::type>::type>::type>::type;
+    };
+
+    template <class Value, class Equal>
+    struct supports : std::integral_constant<bool,
+#if defined(RS_LAZY_FLAT_SET_SIMD_SCAN)
+        std::is_same<Equal, std::equal_to<Value>>::value &&
+        ((std::is_integral<Value>::value && (sizeof(Value) == 1 || sizeof(Value) == 2 || sizeof(Value) == 4 || sizeof(Value) == 8)) ||
+            std::is_same<Value, float>::value || std::is_same<Value, double>::value)
+#else
+        false
+#endif
+    > {};
+
+#if defined(RS_LAZY_FLAT_SET_SIMD_SCAN)
+    template <class Value>
+    static std::size_t find(const Value* data, std::size_t size, Value k) {
+        using lane_type = typename lane<Value>::type;
+        const std::size_t lanes = sizeof(register_type) / sizeof(Value);
+        const auto needle = static_cast<lane_type>(k);
+
+        std::size_t i = 0;
+        for (; i + lanes <= size; i += lanes) {
+            auto bits = mask(equal(data + i, needle));
+            if (bits != 0) {
+                return i + (__builtin_ctz(bits) / sizeof(Value));
             }
-        } else {
-            if (unsorted_.size() == maxUnsortedEntries_) {
-                flushUnsorted();
+        }
+
+        for (; i < size; ++i) {
+            if (data[i] == k) {
+                return i;
             }
+        }
 
-            unsorted_.push_back(k);
+        return size;
+    }
+#endif
+};
+
+// returns the index of the first value in data equal to k, or size when there is no match
+template <class Value, class Equal, bool Simd = LazyFlatSetSimdScan::supports<Value, Equal>::value>
+struct LazyFlatSetUnsortedScan {
+    static std::size_t find(const Value* data, std::size_t size, const Value& k) {
+        return std::search_n(data, data + size, 1, k, Equal{}) - data;
+    }
+};
+
+#if defined(RS_LAZY_FLAT_SET_SIMD_SCAN)
+template <class Value, class Equal>
+struct LazyFlatSetUnsortedScan<Value, Equal, true> {
+    static std::size_t find(const Value* data, std::size_t size, const Value& k) {
+        return LazyFlatSetSimdScan::find(data, size, k);
+    }
+};
+#endif
+
+// returns the index of the first value in the sorted data which is not less than k
+template <class Value, class Less, bool Branchless = std::is_arithmetic<Value>::value && std::is_same<Less, std::less<Value>>::value>
+struct LazyFlatSetSortedSearch {
+    static std::size_t lower_bound(const Value* data, std::size_t size, const Value& k, const Less& less = Less{}) {
+        return std::lower_bound(data, data + size, k, less) - data;
+    }
+};
+
+/**
+ * Branchless binary search for arithmetic values with the default comparator. Each level is a
+ * conditional move rather than a branch, both possible next probes are prefetched, and the last
+ * few values are counted with a loop the compiler can vectorize. Keys outside the range of the
+ * data are answered by comparing with the first and last values.
+**/
+template <class Value, class Less>
+struct LazyFlatSetSortedSearch<Value, Less, true> {
+    static const std::size_t linearSize = 64 / sizeof(Value) > 4 ? 64 / sizeof(Value) : 4;
+
+    static std::size_t lower_bound(const Value* data, std::size_t size, const Value& k) {
+        const Value key = k;
+
+        // ascending and descending inputs mostly probe past the ends, answer those without a search
+        if (size == 0 || !(data[0] < key)) {
+            return 0;
+        } else if (data[size - 1] < key) {
+            return size;
+        }
+
+        const Value* base = data;
+        while (size > linearSize) {
+            const auto half = size / 2;
+#if defined(__GNUC__)
+            __builtin_prefetch(base + (half / 2));
+            __builtin_prefetch(base + half + (half / 2));
+#endif
+            base = base[half] < key ? base + half : base;
+            size -= half;
+        }
+
+        std::size_t less = 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            less += base[i] < key ? 1 : 0;
         }
+
+        return (base - data) + less;
     }
-    
-    template <typename... Args>
-    void emplace(Args&&... args) {
-        if (unsorted_.size() == maxUnsortedEntries_) {
-            flushUnsorted();
+
+    static std::size_t lower_bound(const Value* data, std::size_t size, const Value& k, const Less&) {
+        return lower_bound(data, size, k);
+    }
+};
+
+// searches for the first value not less than k by probing forward from first in doubling steps, which
+// beats a binary search when the value is likely to be near first; ratio is the size difference
+// beyond which walking the smaller of two sorted ranges and galloping through the larger one pays
+struct LazyFlatSetGallop {
+    static const std::size_t ratio = 64;
+
+    template <class Value, class Less>
+    static const Value* lower_bound(const Value* first, const Value* last, const Value& k, const Less& less) {
+        std::size_t step = 1;
+        auto low = first;
+        while (static_cast<std::size_t>(last - first) > step && less(first[step], k)) {
+            low = first + step + 1;
+            first += step;
+            step *= 2;
         }
+        return std::lower_bound(low, static_cast<std::size_t>(last - first) > step ? first + step + 1 : last, k, less);
+    }
 
-        unsorted_.emplace_back(std::forward<Args>(args)...);
-        
-        auto iter = lower_bound_equals(coll_, unsorted_.back());
-        if (iter != coll_.end()) {
-            *iter = std::move(unsorted_.back());
-            unsorted_.pop_back();
-        } else {
-            iter = lower_bound_equals(nursery_, unsorted_.back());
-            if (iter != nursery_.end()) {
-                *iter = std::move(unsorted_.back());
-                unsorted_.pop_back();
-            } else if (unsorted_.size() > 1) {
-                auto newItemIter = unsorted_.end() - 1;
-                
-                iter = search_unsorted(unsorted_, unsorted_.back());
-                if (iter != newItemIter) {
-                    *iter = std::move(unsorted_.back());
-                    unsorted_.pop_back();
+    static bool asymmetric(std::size_t small, std::size_t large) {
+        return large / ratio >= small;
+    }
+};
+
+// intersects two sorted ranges of unique values, the values are taken from the first range
+template <class Value, class Less, bool Simd = LazyFlatSetSimdScan::supports<Value, std::equal_to<Value>>::value && std::is_integral<Value>::value &&
+    (sizeof(Value) == 4 || sizeof(Value) == 8) && std::is_same<Less, std::less<Value>>::value>
+struct LazyFlatSetIntersection {
+    template <class OutputIt>
+    static OutputIt intersect(const Value* a, std::size_t aSize, const Value* b, std::size_t bSize, OutputIt out, const Less& less = Less{}) {
+        if (LazyFlatSetGallop::asymmetric(aSize, bSize)) {
+            auto bIter = b;
+            for (auto aIter = a, aEnd = a + aSize; aIter != aEnd && bIter != b + bSize; ++aIter) {
+                bIter = LazyFlatSetGallop::lower_bound(bIter, b + bSize, *aIter, less);
+                if (bIter != b + bSize && !less(*aIter, *bIter)) {
+                    *out++ = *aIter;
                 }
             }
+            return out;
+        } else if (LazyFlatSetGallop::asymmetric(bSize, aSize)) {
+            auto aIter = a;
+            for (auto bIter = b, bEnd = b + bSize; bIter != bEnd && aIter != a + aSize; ++bIter) {
+                aIter = LazyFlatSetGallop::lower_bound(aIter, a + aSize, *bIter, less);
+                if (aIter != a + aSize && !less(*bIter, *aIter)) {
+                    *out++ = *aIter;
+                }
+            }
+            return out;
         }
+
+        return std::set_intersection(a, a + aSize, b, b + bSize, out, less);
     }
-    
-    bool empty() const {
-        return coll_.empty() && nursery_.empty() && unsorted_.empty();
-    }
-    
-    void clear() {
-        coll_.clear();
-        nursery_.clear();
-        unsorted_.clear();
+};
+
+#if defined(RS_LAZY_FLAT_SET_SIMD_SCAN)
+/**
+ * Vectorized intersection of 32 and 64 bit integers. A register of values from each range is compared
+ * all against all, by comparing the first register with each value of the second in turn, and the
+ * range whose register ends with the smaller value moves on. Very different sizes still gallop.
+**/
+template <class Value, class Less>
+struct LazyFlatSetIntersection<Value, Less, true> {
+    template <class OutputIt>
+    static OutputIt intersect(const Value* a, std::size_t aSize, const Value* b, std::size_t bSize, OutputIt out, const Less& less = Less{}) {
+        if (LazyFlatSetGallop::asymmetric(aSize, bSize) || LazyFlatSetGallop::asymmetric(bSize, aSize)) {
+            return LazyFlatSetIntersection<Value, Less, false>::intersect(a, aSize, b, bSize, out, less);
+        }
+
+        using lane_type = typename LazyFlatSetSimdScan::lane<Value>::type;
+        const std::size_t lanes = sizeof(LazyFlatSetSimdScan::register_type) / sizeof(Value);
+        const unsigned laneMask = (1u << sizeof(Value)) - 1;
+
+        std::size_t i = 0, j = 0;
+        while (i + lanes <= aSize && j + lanes <= bSize) {
+            unsigned bits = 0;
+            for (std::size_t k = 0; k < lanes; ++k) {
+                bits |= LazyFlatSetSimdScan::mask(LazyFlatSetSimdScan::equal(a + i, static_cast<lane_type>(b[j + k])));
+            }
+
+            while (bits != 0) {
+                const auto lane = __builtin_ctz(bits) / sizeof(Value);
+                *out++ = a[i + lane];
+                bits &= ~(laneMask << (lane * sizeof(Value)));
+            }
+
+            const auto aLast = a[i + lanes - 1];
+            const auto bLast = b[j + lanes - 1];
+            i += aLast <= bLast ? lanes : 0;
+            j += bLast <= aLast ? lanes : 0;
+        }
+
+        return std::set_intersection(a + i, a + aSize, b + j, b + bSize, out, less);
     }
-    
-    void clear_fn(erase_type erase) {
-        for (auto i : coll_) {
-            erase(i);
+};
+#endif
+
+/**
+ * A fixed set of worker threads for the parallel sorts and merges of LazyFlatSet. The thread calling
+ * run() takes tasks as well, so a pool with n workers runs n + 1 tasks at once. A pool can be shared
+ * by any number of sets, calls to run() from different threads take turns.
+**/
+class LazyFlatSetThreadPool {
+public:
+    explicit LazyFlatSetThreadPool(unsigned workers = std::max(std::thread::hardware_concurrency(), 1u) - 1) :
+            job_(nullptr), count_(0), next_(0), pending_(0), generation_(0), stop_(false) {
+        for (unsigned i = 0; i < workers; ++i) {
+            threads_.emplace_back([this]() { work(); });
         }
-        
-        coll_.clear();
-        
-        for (auto i : nursery_) {
-            erase(i);
+    }
+
+    LazyFlatSetThreadPool(const LazyFlatSetThreadPool&) = delete;
+    LazyFlatSetThreadPool& operator=(const LazyFlatSetThreadPool&) = delete;
+
+    ~LazyFlatSetThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
         }
-        
-        nursery_.clear();
-        
-        for (auto i : unsorted_) {
-            erase(i);
+        wake_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
         }
-        
-        unsorted_.clear();
     }
-    
-    void reserve(size_type n) {
-        coll_.reserve(n);
+
+    unsigned concurrency() const {
+        return threads_.size() + 1;
     }
-    
-    size_type size() const {
-        return coll_.size() + nursery_.size() + unsorted_.size();
+
+    // calls task(i) for each i in [0, count) and returns once every call has finished, the first
+    // exception thrown by a task is rethrown here
+    template <class Task>
+    void run(std::size_t count, Task task) {
+        std::lock_guard<std::mutex> turn(turn_);
+        std::function<void(std::size_t)> job(task);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &job;
+            count_ = count;
+            next_ = 0;
+            pending_ = count;
+            error_ = nullptr;
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        execute();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return pending_ == 0; });
+        job_ = nullptr;
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
     }
 
-    void shrink_to_fit() {
-        flush();
-        nursery_.shrink_to_fit();
-        coll_.shrink_to_fit();
+    // the pool used by sets that are not given one
+    static LazyFlatSetThreadPool& shared() {
+        static LazyFlatSetThreadPool pool;
+        return pool;
     }
-    
-    size_type count(const value_type& k) const {
-        size_type found = 0;
-        
-        auto iter = lower_bound_equals(coll_, k);
-        if (iter != coll_.end()) {
-            found = 1;
-        } else {
-            iter = lower_bound_equals(nursery_, k);
-            if (iter != nursery_.end()) {
-                found = 1;
-            } else {
-                iter = search_unsorted(unsorted_, k);
-                if (iter != unsorted_.end()) {
-                    found = 1;
+
+private:
+    void work() {
+        std::uint64_t generation = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&]() { return stop_ || generation_ != generation; });
+                if (stop_) {
+                    return;
                 }
+                generation = generation_;
             }
+            execute();
         }
-        
-        return found;
-    }   
-    
-    size_type count_fn(compare_type compare) const {
-        size_type found = 0;
-        
-        auto index = search(coll_, compare);
-        if (index != search_end) {
-            found = 1;
-        } else {
-            index = search(nursery_, compare);
-            if (index != search_end) {
-                found = 1;
-            } else {
-                index = search_unsorted(unsorted_, compare);
-                if (index != search_end) {
-                    found = 1;
+    }
+
+    void execute() {
+        for (;;) {
+            std::function<void(std::size_t)>* job;
+            std::size_t i;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (next_ >= count_) {
+                    return;
                 }
+                job = job_;
+                i = next_++;
+            }
+
+            std::exception_ptr error;
+            try {
+                (*job)(i);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (error && !error_) {
+                error_ = error;
+            }
+            if (--pending_ == 0) {
+                done_.notify_all();
             }
         }
-        
-        return found;
     }
-    
-    bool find(const value_type& k, value_type& v) const {
-        auto found = false;
-        
-        auto iter = lower_bound_equals(coll_, k);
-        if (iter != coll_.end()) {
-            v = *iter;
-            found = true;
-        } else {
-            iter = lower_bound_equals(nursery_, k);
-            if (iter != nursery_.end()) {
-                v = *iter;
-                found = true;
+
+    std::vector<std::thread> threads_;
+    std::mutex turn_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::function<void(std::size_t)>* job_;
+    std::size_t count_;
+    std::size_t next_;
+    std::size_t pending_;
+    std::uint64_t generation_;
+    std::exception_ptr error_;
+    bool stop_;
+};
+
+// splits the merge of two sorted ranges so that the pieces can be merged independently, where the
+// merged output is cut at k the first k values hold split(...) values from a and the rest from b;
+// equal values from a come before those from b
+struct LazyFlatSetMergePath {
+    template <class RandomIt, class Less>
+    static std::size_t split(RandomIt a, std::size_t aSize, RandomIt b, std::size_t bSize, std::size_t k, const Less& less) {
+        auto low = k > bSize ? k - bSize : 0;
+        auto high = std::min(k, aSize);
+        while (low < high) {
+            const auto mid = low + (high - low) / 2;
+            if (!less(b[k - mid - 1], a[mid])) {
+                low = mid + 1;
             } else {
-                iter = search_unsorted(unsorted_, k);
-                if (iter != unsorted_.end()) {
-                    v = *iter;
-                    found = true;
-                }
+                high = mid;
             }
         }
-        
-         return found;
+        return low;
+    }
+};
+
+// the default filter policy, every value may be in the tier so each tier is always searched
+template <class Value>
+struct LazyFlatSetNoFilter {
+    LazyFlatSetNoFilter(std::size_t) {}
+
+    void insert(const Value&) {}
+    bool may_contain(const Value&) const { return true; }
+    void clear() {}
+    std::size_t memory() const { return 0; }
+};
+
+// the counters reported by LazyFlatSet::stats()
+struct LazyFlatSetStatistics {
+    std::uint64_t unsorted_flushes = 0;
+    std::uint64_t nursery_flushes = 0;
+    std::uint64_t level_flushes = 0;
+    std::uint64_t append_merges = 0;
+    std::uint64_t prepend_merges = 0;
+    std::uint64_t inplace_merges = 0;
+    std::uint64_t moved = 0;
+    std::uint64_t main_hits = 0;
+    std::uint64_t level_hits = 0;
+    std::uint64_t nursery_hits = 0;
+    std::uint64_t unsorted_hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t comparisons = 0;
+};
+
+// wraps Less to count each call
+template <class Less>
+struct LazyFlatSetCountingLess {
+    template <class A, class B>
+    bool operator()(const A& a, const B& b) const {
+        ++*comparisons;
+        return less(a, b);
+    }
+
+    Less less;
+    std::uint64_t* comparisons;
+};
+
+// the default statistics policy, nothing is recorded and the set's comparator is used as it is
+struct LazyFlatSetNoStats {
+    template <class Less> using less_type = Less;
+
+    template <class Less>
+    Less less() { return Less{}; }
+
+    void count(std::uint64_t LazyFlatSetStatistics::*) {}
+    void moved(std::size_t) {}
+    LazyFlatSetStatistics get() const { return LazyFlatSetStatistics(); }
+    void reset() {}
+};
+
+/**
+ * A statistics policy counting flushes, the path each merge takes, the values moved by merges,
+ * lookup hits by tier and calls to Less made by the set's searches and merges (but not by Sort or
+ * by parallel sorts and merges).
+ * Const lookups update the counters so a set using this policy must not be read concurrently.
+**/
+class LazyFlatSetStats {
+public:
+    template <class Less> using less_type = LazyFlatSetCountingLess<Less>;
+
+    template <class Less>
+    less_type<Less> less() { return less_type<Less>{ Less{}, &stats_.comparisons }; }
+
+    void count(std::uint64_t LazyFlatSetStatistics::* counter) { ++(stats_.*counter); }
+    void moved(std::size_t n) { stats_.moved += n; }
+    LazyFlatSetStatistics get() const { return stats_; }
+    void reset() { stats_ = LazyFlatSetStatistics(); }
+
+private:
+    LazyFlatSetStatistics stats_;
+};
+
+/**
+ * A blocked Bloom filter policy for the nursery and unsorted tiers. Each value sets Probes bits in a
+ * single 512 bit (cache line) block so a test touches one line of memory. Hash must agree with the
+ * set's Equal, eg. for pointer sets it should hash the pointed to value rather than the address.
+**/
+template <class Value, class Hash = std::hash<Value>, unsigned BitsPerValue = 12, unsigned Probes = 7>
+class LazyFlatSetBloomFilter {
+public:
+    LazyFlatSetBloomFilter(std::size_t capacity) :
+            blocks_(std::max<std::size_t>(1, ((capacity * BitsPerValue) + blockBits - 1) / blockBits)),
+            bits_(blocks_ * blockWords, 0) {
+    }
+
+    void insert(const Value& k) {
+        auto hash = mix(Hash{}(k));
+        auto block = bits_.data() + (blockIndex(hash) * blockWords);
+        auto probes = mix(hash ^ probeSeed);
+        for (unsigned i = 0; i < Probes; ++i) {
+            auto bit = (probes >> (i * 9)) & (blockBits - 1);
+            block[bit / 64] |= std::uint64_t(1) << (bit % 64);
+        }
+    }
+
+    bool may_contain(const Value& k) const {
+        auto hash = mix(Hash{}(k));
+        auto block = bits_.data() + (blockIndex(hash) * blockWords);
+        auto probes = mix(hash ^ probeSeed);
+        for (unsigned i = 0; i < Probes; ++i) {
+            auto bit = (probes >> (i * 9)) & (blockBits - 1);
+            if ((block[bit / 64] & (std::uint64_t(1) << (bit % 64))) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void clear() {
+        std::fill(bits_.begin(), bits_.end(), 0);
+    }
+
+    std::size_t memory() const {
+        return bits_.capacity() * sizeof(std::uint64_t);
+    }
+
+private:
+    static const std::size_t blockBits = 512;
+    static const std::size_t blockWords = blockBits / 64;
+
+    // the block is chosen by the high bits of the hash and the probe bits are taken from a second hash,
+    // probes sharing bits with the block index would be correlated and raise the false positive rate
+    static const std::uint64_t probeSeed = 0x9e3779b97f4a7c15ULL;
+
+    static_assert(Probes * 9 <= 64, "each probe takes 9 bits of the 64 bit probe hash");
+
+    // spreads weak hashes (eg. std::hash<unsigned> is the identity) over all 64 bits, from MurmurHash3
+    static std::uint64_t mix(std::uint64_t hash) {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    std::size_t blockIndex(std::uint64_t hash) const {
+        return static_cast<std::size_t>(((hash >> 32) * blocks_) >> 32);
+    }
+
+    std::size_t blocks_;
+    std::vector<std::uint64_t> bits_;
+};
+
+/**
+ * The header of the snapshot files written by LazyFlatSet::save() and mapped by MappedLazyFlatSet.
+ * The sorted values follow the header exactly as they are held in memory, so a snapshot can only be
+ * read on a machine with the same byte order and by a set of the same trivially copyable type;
+ * the value size and alignment are recorded to catch the most likely mistakes.
+**/
+struct LazyFlatSetSnapshotHeader {
+    static const std::uint32_t currentVersion = 1;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t valueSize;
+    std::uint32_t valueAlign;
+    std::uint32_t reserved;
+    std::uint64_t count;
+
+    template <class Value>
+    bool valid(std::size_t fileSize) const {
+        return std::memcmp(magic, "RSLFSET", sizeof(magic)) == 0 && version == currentVersion && valueSize == sizeof(Value) &&
+            valueAlign == alignof(Value) && fileSize >= sizeof(*this) && (fileSize - sizeof(*this)) / sizeof(Value) == count &&
+            (fileSize - sizeof(*this)) % sizeof(Value) == 0;
+    }
+
+    // writes count values to a file alongside path which is then renamed over it, a process still
+    // mapping the previous snapshot keeps reading that rather than seeing it truncated
+    template <class Value, class InputIt>
+    static bool write(const std::string& path, InputIt first, InputIt last, std::uint64_t count) {
+        static_assert(std::is_trivially_copyable<Value>::value && !std::is_pointer<Value>::value, "snapshots hold trivially copyable values");
+        static_assert(alignof(Value) <= sizeof(LazyFlatSetSnapshotHeader), "the values follow the header so can't be aligned beyond it");
+
+        LazyFlatSetSnapshotHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "RSLFSET", sizeof(header.magic));
+        header.version = currentVersion;
+        header.valueSize = sizeof(Value);
+        header.valueAlign = alignof(Value);
+        header.count = count;
+
+        const auto temp = path + ".tmp";
+        std::ofstream stream(temp.c_str(), std::ios::binary | std::ios::trunc);
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writeValues(stream, first, last, std::is_pointer<InputIt>());
+        stream.close();
+
+        if (!stream || std::rename(temp.c_str(), path.c_str()) != 0) {
+            std::remove(temp.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    template <class InputIt>
+    static void writeValues(std::ofstream& stream, InputIt first, InputIt last, std::true_type) {
+        stream.write(reinterpret_cast<const char*>(first), (last - first) * sizeof(*first));
+    }
+
+    template <class InputIt>
+    static void writeValues(std::ofstream& stream, InputIt first, InputIt last, std::false_type) {
+        for (; first != last && stream; ++first) {
+            stream.write(reinterpret_cast<const char*>(&*first), sizeof(*first));
+        }
+    }
+};
+
+/**
+ * The memory resource behind LazyFlatSetPolymorphicAllocator, a C++11 stand in for
+ * std::pmr::memory_resource. With C++17 std::pmr::polymorphic_allocator works as the Alloc
+ * of a set in the same way.
+**/
+class LazyFlatSetMemoryResource {
+public:
+    virtual ~LazyFlatSetMemoryResource() {}
+
+    void* allocate(std::size_t bytes, std::size_t alignment) {
+        return do_allocate(bytes, alignment);
+    }
+
+    void deallocate(void* p, std::size_t bytes, std::size_t alignment) {
+        do_deallocate(p, bytes, alignment);
+    }
+
+    bool is_equal(const LazyFlatSetMemoryResource& other) const noexcept {
+        return do_is_equal(other);
+    }
+
+    // the resource used when none is given, it allocates with operator new
+    static LazyFlatSetMemoryResource* default_resource();
+
+protected:
+    virtual void* do_allocate(std::size_t bytes, std::size_t alignment) = 0;
+    virtual void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) = 0;
+    virtual bool do_is_equal(const LazyFlatSetMemoryResource& other) const noexcept = 0;
+};
+
+class LazyFlatSetNewDeleteResource : public LazyFlatSetMemoryResource {
+protected:
+    // blocks aligned beyond what operator new guarantees use the aligned operator new where there is
+    // one, otherwise the block is over allocated and the pointer operator new returned is kept in the
+    // word before the aligned block
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (alignment <= newAlignment) {
+            return ::operator new(bytes);
+        }
+
+#if defined(__cpp_aligned_new)
+        return ::operator new(bytes, std::align_val_t(alignment));
+#else
+        auto block = static_cast<char*>(::operator new(bytes + alignment + sizeof(void*)));
+        auto aligned = reinterpret_cast<void**>((reinterpret_cast<std::uintptr_t>(block) + sizeof(void*) + alignment - 1) & ~(alignment - 1));
+        aligned[-1] = block;
+        return aligned;
+#endif
+    }
+
+    void do_deallocate(void* p, std::size_t, std::size_t alignment) override {
+        if (alignment <= newAlignment) {
+            ::operator delete(p);
+        } else {
+#if defined(__cpp_aligned_new)
+            ::operator delete(p, std::align_val_t(alignment));
+#else
+            ::operator delete(static_cast<void**>(p)[-1]);
+#endif
+        }
+    }
+
+    bool do_is_equal(const LazyFlatSetMemoryResource& other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+#if defined(__STDCPP_DEFAULT_NEW_ALIGNMENT__)
+    static const std::size_t newAlignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+#else
+    static const std::size_t newAlignment = alignof(std::max_align_t);
+#endif
+};
+
+inline LazyFlatSetMemoryResource* LazyFlatSetMemoryResource::default_resource() {
+    static LazyFlatSetNewDeleteResource resource;
+    return &resource;
+}
+
+/**
+ * A memory resource for short lived sets. Blocks are rounded up to a power of two and carved from
+ * chunks taken from the upstream resource, starting with the buffer given to the constructor if
+ * any (eg. one on the stack). A freed block goes on a free list for its size and is reused, so the
+ * unsorted and nursery tiers being filled and cleared don't go back upstream. Everything is returned
+ * upstream by release() or the destructor. An arena must outlive the sets using it and must not be
+ * shared between threads.
+**/
+class LazyFlatSetArenaResource : public LazyFlatSetMemoryResource {
+public:
+    explicit LazyFlatSetArenaResource(std::size_t chunkSize = 64 * 1024, LazyFlatSetMemoryResource* upstream = default_resource()) :
+            LazyFlatSetArenaResource(nullptr, 0, chunkSize, upstream) {
+    }
+
+    LazyFlatSetArenaResource(void* buffer, std::size_t size, std::size_t chunkSize = 64 * 1024, LazyFlatSetMemoryResource* upstream = default_resource()) :
+            upstream_(upstream), chunkSize_(chunkSize), chunks_(nullptr), buffer_(static_cast<char*>(buffer)), bufferEnd_(buffer_ + size), upstreamBytes_(0) {
+        release();
+    }
+
+    LazyFlatSetArenaResource(const LazyFlatSetArenaResource&) = delete;
+    LazyFlatSetArenaResource& operator=(const LazyFlatSetArenaResource&) = delete;
+
+    ~LazyFlatSetArenaResource() {
+        release();
+    }
+
+    // returns every chunk upstream and starts again from the initial buffer, anything allocated
+    // from the arena must no longer be in use
+    void release() {
+        while (chunks_ != nullptr) {
+            auto next = chunks_->next;
+            upstream_->deallocate(chunks_, chunks_->size, maxAlignment);
+            chunks_ = next;
+        }
+
+        current_ = buffer_;
+        end_ = bufferEnd_;
+        upstreamBytes_ = 0;
+        std::fill(std::begin(free_), std::end(free_), nullptr);
+    }
+
+    // the bytes held in chunks taken from the upstream resource
+    std::size_t upstream_bytes() const {
+        return upstreamBytes_;
+    }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (alignment > maxAlignment) {
+            return upstream_->allocate(bytes, alignment);
+        }
+
+        const auto index = sizeClass(bytes);
+        if (free_[index] != nullptr) {
+            auto block = free_[index];
+            free_[index] = block->next;
+            return block;
+        }
+
+        const auto size = minBlock << index;
+        auto first = align(current_);
+        if (current_ == nullptr || first > end_ || static_cast<std::size_t>(end_ - first) < size) {
+            addChunk(size);
+            first = current_;
+        }
+
+        current_ = first + size;
+        return first;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        if (alignment > maxAlignment) {
+            upstream_->deallocate(p, bytes, alignment);
+        } else {
+            const auto index = sizeClass(bytes);
+            auto block = static_cast<free_block*>(p);
+            block->next = free_[index];
+            free_[index] = block;
+        }
+    }
+
+    bool do_is_equal(const LazyFlatSetMemoryResource& other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    struct chunk {
+        chunk* next;
+        std::size_t size;
+    };
+
+    struct free_block {
+        free_block* next;
+    };
+
+    static const std::size_t minBlock = 16;
+    static const std::size_t maxAlignment = 16;
+
+    static unsigned sizeClass(std::size_t bytes) {
+        unsigned index = 0;
+        while ((minBlock << index) < bytes) {
+            ++index;
+        }
+        return index;
+    }
+
+    static char* align(char* p) {
+        return reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(p) + maxAlignment - 1) & ~(maxAlignment - 1));
+    }
+
+    void addChunk(std::size_t size) {
+        const auto chunkSize = std::max(chunkSize_, size + sizeof(chunk));
+        auto c = static_cast<chunk*>(upstream_->allocate(chunkSize, maxAlignment));
+        c->next = chunks_;
+        c->size = chunkSize;
+        chunks_ = c;
+        upstreamBytes_ += chunkSize;
+
+        current_ = align(reinterpret_cast<char*>(c + 1));
+        end_ = reinterpret_cast<char*>(c) + chunkSize;
+    }
+
+    LazyFlatSetMemoryResource* const upstream_;
+    const std::size_t chunkSize_;
+    chunk* chunks_;
+    char* const buffer_;
+    char* const bufferEnd_;
+    char* current_;
+    char* end_;
+    std::size_t upstreamBytes_;
+    free_block* free_[sizeof(std::size_t) * 8];
+};
+
+/**
+ * An allocator drawing from a LazyFlatSetMemoryResource, like std::pmr::polymorphic_allocator.
+ * Give each tier its own allocator through the LazyFlatSet constructor to put, say, the
+ * unsorted and nursery tiers in an arena while the main collection uses the heap. As with
+ * std::pmr a copy of a set uses the default resource rather than sharing the original's.
+**/
+template <class T>
+class LazyFlatSetPolymorphicAllocator {
+public:
+    using value_type = T;
+
+    LazyFlatSetPolymorphicAllocator() noexcept : resource_(LazyFlatSetMemoryResource::default_resource()) {}
+
+    LazyFlatSetPolymorphicAllocator(LazyFlatSetMemoryResource* resource) noexcept : resource_(resource) {}
+
+    template <class U>
+    LazyFlatSetPolymorphicAllocator(const LazyFlatSetPolymorphicAllocator<U>& other) noexcept : resource_(other.resource()) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(resource_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        resource_->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    LazyFlatSetPolymorphicAllocator select_on_container_copy_construction() const {
+        return LazyFlatSetPolymorphicAllocator();
+    }
+
+    LazyFlatSetMemoryResource* resource() const noexcept {
+        return resource_;
+    }
+
+private:
+    LazyFlatSetMemoryResource* resource_;
+};
+
+template <class T, class U>
+bool operator==(const LazyFlatSetPolymorphicAllocator<T>& a, const LazyFlatSetPolymorphicAllocator<U>& b) noexcept {
+    return a.resource() == b.resource() || a.resource()->is_equal(*b.resource());
+}
+
+template <class T, class U>
+bool operator!=(const LazyFlatSetPolymorphicAllocator<T>& a, const LazyFlatSetPolymorphicAllocator<U>& b) noexcept {
+    return !(a == b);
+}
+
+// the collection each tier of a set is held in
+template <class Value, class Alloc>
+struct LazyFlatSetCollection {
+    using type = std::vector<Value, Alloc>;
+};
+
+#if defined(RS_LAZY_FLAT_SET_MREMAP)
+/**
+ * An allocator for very large sets of trivially copyable values on Linux. Blocks of at least
+ * mapThreshold bytes are anonymous mappings advised to use transparent huge pages, smaller ones
+ * come from operator new. A set using it holds its tiers in a LazyFlatSetMappedBuffer, which grows
+ * a mapped block with reallocate() rather than copying the values into a new one, so growing is
+ * cheap and the old and new collections are never resident at the same time.
+**/
+template <class T>
+class LazyFlatSetMappedAllocator {
+    static_assert(std::is_trivially_copyable<T>::value, "mapped blocks are moved by the kernel so the values must be trivially copyable");
+
+public:
+    using value_type = T;
+
+    static const std::size_t mapThreshold = 2 * 1024 * 1024;
+
+    LazyFlatSetMappedAllocator() noexcept {}
+
+    template <class U>
+    LazyFlatSetMappedAllocator(const LazyFlatSetMappedAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if (!mapped(n)) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+
+        auto block = ::mmap(nullptr, mappedBytes(n), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+
+        ::madvise(block, mappedBytes(n), MADV_HUGEPAGE);
+        return static_cast<T*>(block);
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        if (mapped(n)) {
+            ::munmap(p, mappedBytes(n));
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    // moves or resizes the mapping holding oldN values so that it holds newN, the values keep their place
+    // in the returned block; null when either size is below the threshold or the block can't be remapped,
+    // the block is then unchanged
+    static T* reallocate(T* p, std::size_t oldN, std::size_t newN) {
+        if (p == nullptr || !mapped(oldN) || !mapped(newN)) {
+            return nullptr;
+        }
+
+        auto block = ::mremap(p, mappedBytes(oldN), mappedBytes(newN), MREMAP_MAYMOVE);
+        if (block == MAP_FAILED) {
+            return nullptr;
+        }
+
+        ::madvise(block, mappedBytes(newN), MADV_HUGEPAGE);
+        return static_cast<T*>(block);
+    }
+
+private:
+    static bool mapped(std::size_t n) {
+        return n * sizeof(T) >= mapThreshold;
+    }
+
+    static std::size_t mappedBytes(std::size_t n) {
+        static const std::size_t page = ::sysconf(_SC_PAGESIZE);
+        return (((n * sizeof(T)) + page - 1) / page) * page;
+    }
+};
+
+template <class T, class U>
+bool operator==(const LazyFlatSetMappedAllocator<T>&, const LazyFlatSetMappedAllocator<U>&) noexcept {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const LazyFlatSetMappedAllocator<T>&, const LazyFlatSetMappedAllocator<U>&) noexcept {
+    return false;
+}
+
+/**
+ * The collection the tiers of a set using LazyFlatSetMappedAllocator are held in: a vector of
+ * trivially copyable values which owns its block, so when it grows a mapped block is remapped by
+ * LazyFlatSetMappedAllocator::reallocate() and only an unmapped one is copied. It provides the
+ * part of the std::vector interface the set uses, with the same iterator invalidation rules.
+**/
+template <class T>
+class LazyFlatSetMappedBuffer {
+public:
+    using value_type = T;
+    using allocator_type = LazyFlatSetMappedAllocator<T>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using iterator = T*;
+    using const_iterator = const T*;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    explicit LazyFlatSetMappedBuffer(const allocator_type& = allocator_type()) noexcept : data_(nullptr), size_(0), capacity_(0) {}
+
+    explicit LazyFlatSetMappedBuffer(size_type count, const allocator_type& alloc = allocator_type()) : LazyFlatSetMappedBuffer(alloc) {
+        resize(count);
+    }
+
+    LazyFlatSetMappedBuffer(size_type count, const T& value, const allocator_type& alloc = allocator_type()) : LazyFlatSetMappedBuffer(alloc) {
+        insert(end(), count, value);
+    }
+
+    template <class InputIt, class = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    LazyFlatSetMappedBuffer(InputIt first, InputIt last, const allocator_type& alloc = allocator_type()) : LazyFlatSetMappedBuffer(alloc) {
+        insert(end(), first, last);
+    }
+
+    LazyFlatSetMappedBuffer(std::initializer_list<T> values, const allocator_type& alloc = allocator_type()) : LazyFlatSetMappedBuffer(alloc) {
+        insert(end(), values.begin(), values.end());
+    }
+
+    LazyFlatSetMappedBuffer(const LazyFlatSetMappedBuffer& other) : LazyFlatSetMappedBuffer() {
+        insert(end(), other.begin(), other.end());
+    }
+
+    LazyFlatSetMappedBuffer(LazyFlatSetMappedBuffer&& other) noexcept : LazyFlatSetMappedBuffer() {
+        swap(other);
+    }
+
+    ~LazyFlatSetMappedBuffer() {
+        release();
+    }
+
+    LazyFlatSetMappedBuffer& operator=(const LazyFlatSetMappedBuffer& other) {
+        if (this != &other) {
+            assign(other.begin(), other.end());
+        }
+        return *this;
+    }
+
+    LazyFlatSetMappedBuffer& operator=(LazyFlatSetMappedBuffer&& other) noexcept {
+        LazyFlatSetMappedBuffer moved(std::move(other));
+        swap(moved);
+        return *this;
+    }
+
+    allocator_type get_allocator() const noexcept {
+        return allocator_type();
+    }
+
+    iterator begin() noexcept { return data_; }
+    const_iterator begin() const noexcept { return data_; }
+    const_iterator cbegin() const noexcept { return data_; }
+    iterator end() noexcept { return data_ + size_; }
+    const_iterator end() const noexcept { return data_ + size_; }
+    const_iterator cend() const noexcept { return data_ + size_; }
+    reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+    const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+    const_reverse_iterator crbegin() const noexcept { return const_reverse_iterator(end()); }
+    reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+    const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+    const_reverse_iterator crend() const noexcept { return const_reverse_iterator(begin()); }
+
+    size_type size() const noexcept { return size_; }
+    size_type capacity() const noexcept { return capacity_; }
+    size_type max_size() const noexcept { return static_cast<size_type>(-1) / sizeof(T); }
+    bool empty() const noexcept { return size_ == 0; }
+
+    T* data() noexcept { return data_; }
+    const T* data() const noexcept { return data_; }
+    T& operator[](size_type index) { return data_[index]; }
+    const T& operator[](size_type index) const { return data_[index]; }
+    T& front() { return data_[0]; }
+    const T& front() const { return data_[0]; }
+    T& back() { return data_[size_ - 1]; }
+    const T& back() const { return data_[size_ - 1]; }
+
+    // a mapped block is remapped to the new capacity, anything else is copied to a new block
+    void reserve(size_type capacity) {
+        if (capacity <= capacity_) {
+            return;
+        }
+
+        auto block = allocator_type::reallocate(data_, capacity_, capacity);
+        if (block == nullptr) {
+            block = allocator_type().allocate(capacity);
+            const auto size = size_;
+            if (size > 0) {
+                std::memcpy(block, data_, size * sizeof(T));
+            }
+            release();
+            size_ = size;
+        }
+
+        data_ = block;
+        capacity_ = capacity;
+    }
+
+    void shrink_to_fit() {
+        if (capacity_ > size_) {
+            LazyFlatSetMappedBuffer shrunk(*this);
+            swap(shrunk);
+        }
+    }
+
+    void resize(size_type size) {
+        resize(size, T());
+    }
+
+    void resize(size_type size, const T& value) {
+        if (size > size_) {
+            insert(end(), size - size_, value);
+        } else {
+            size_ = size;
+        }
+    }
+
+    void clear() noexcept {
+        size_ = 0;
+    }
+
+    void push_back(const T& value) {
+        emplace_back(value);
+    }
+
+    template <class... Args>
+    void emplace_back(Args&&... args) {
+        T value(std::forward<Args>(args)...);
+        room(end(), 1);
+        ::new (static_cast<void*>(data_ + size_)) T(value);
+        ++size_;
+    }
+
+    void pop_back() {
+        --size_;
+    }
+
+    iterator insert(const_iterator pos, const T& value) {
+        return insert(pos, 1, value);
+    }
+
+    iterator insert(const_iterator pos, size_type count, const T& value) {
+        const T copy(value);
+        auto out = room(pos, count);
+        std::uninitialized_fill_n(out, count, copy);
+        size_ += count;
+        return out;
+    }
+
+    template <class InputIt, class = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    iterator insert(const_iterator pos, InputIt first, InputIt last) {
+        return insert(pos, first, last, typename std::iterator_traits<InputIt>::iterator_category());
+    }
+
+    iterator erase(const_iterator pos) {
+        return erase(pos, pos + 1);
+    }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        const auto index = first - data_;
+        const auto count = last - first;
+        if (count > 0) {
+            std::memmove(data_ + index, last, (cend() - last) * sizeof(T));
+            size_ -= count;
+        }
+        return data_ + index;
+    }
+
+    void assign(size_type count, const T& value) {
+        clear();
+        insert(end(), count, value);
+    }
+
+    template <class InputIt, class = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    void assign(InputIt first, InputIt last) {
+        clear();
+        insert(end(), first, last);
+    }
+
+    void swap(LazyFlatSetMappedBuffer& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+    }
+
+private:
+    template <class InputIt>
+    iterator insert(const_iterator pos, InputIt first, InputIt last, std::forward_iterator_tag) {
+        const auto count = static_cast<size_type>(std::distance(first, last));
+        auto out = room(pos, count);
+        std::uninitialized_copy(first, last, out);
+        size_ += count;
+        return out;
+    }
+
+    template <class InputIt>
+    iterator insert(const_iterator pos, InputIt first, InputIt last, std::input_iterator_tag) {
+        const auto index = pos - data_;
+        const auto size = size_;
+        for (; first != last; ++first) {
+            emplace_back(*first);
+        }
+        std::rotate(data_ + index, data_ + size, end());
+        return data_ + index;
+    }
+
+    // opens a gap of count values at pos, growing the block geometrically when it is full; the caller
+    // fills the gap and adds count to the size
+    iterator room(const_iterator pos, size_type count) {
+        const auto index = pos - data_;
+        if (size_ + count > capacity_) {
+            reserve(std::max(size_ + count, capacity_ * 2));
+        }
+
+        if (static_cast<size_type>(index) < size_) {
+            std::memmove(data_ + index + count, data_ + index, (size_ - index) * sizeof(T));
+        }
+        return data_ + index;
+    }
+
+    void release() noexcept {
+        if (data_ != nullptr) {
+            allocator_type().deallocate(data_, capacity_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+        capacity_ = 0;
+    }
+
+    T* data_;
+    size_type size_;
+    size_type capacity_;
+};
+
+template <class T>
+struct LazyFlatSetCollection<T, LazyFlatSetMappedAllocator<T>> {
+    using type = LazyFlatSetMappedBuffer<T>;
+};
+#endif
+
+// a 64 bit checksum taken a word at a time, the writer and reader must pass it the same spans
+class LazyFlatSetChecksum {
+public:
+    LazyFlatSetChecksum() : value_(14695981039346656037ull) {}
+
+    void update(const void* data, std::size_t size) {
+        auto bytes = static_cast<const unsigned char*>(data);
+        for (; size >= sizeof(std::uint64_t); bytes += sizeof(std::uint64_t), size -= sizeof(std::uint64_t)) {
+            std::uint64_t word;
+            std::memcpy(&word, bytes, sizeof(word));
+            mix(word);
+        }
+
+        for (; size > 0; ++bytes, --size) {
+            mix(*bytes);
+        }
+    }
+
+    std::uint64_t value() const {
+        return value_;
+    }
+
+private:
+    void mix(std::uint64_t word) {
+        value_ = (value_ ^ word) * 1099511628211ull;
+        value_ ^= value_ >> 32;
+    }
+
+    std::uint64_t value_;
+};
+
+// the number of bytes left in a stream, or -1 when the stream can't seek
+struct LazyFlatSetStreamLength {
+    static std::int64_t remaining(std::istream& stream) {
+        const auto position = stream.tellg();
+        if (position == std::istream::pos_type(-1)) {
+            return -1;
+        }
+
+        stream.seekg(0, std::ios::end);
+        const auto end = stream.tellg();
+        stream.clear();
+        stream.seekg(position);
+        return end == std::istream::pos_type(-1) ? -1 : static_cast<std::int64_t>(end - position);
+    }
+};
+
+/**
+ * Writes and reads the values of a LazyFlatSet stream, see LazyFlatSet::serialize(). Trivially
+ * copyable values are written as they are held in memory and read straight into the main
+ * collection; strings are written as a 64 bit length followed by the characters. Specialize this
+ * for other types, providing format, checksum(), write() and read() as below.
+**/
+template <class Value, class Enable = void>
+struct LazyFlatSetSerializer;
+
+template <class Value>
+struct LazyFlatSetSerializer<Value, typename std::enable_if<std::is_trivially_copyable<Value>::value && !std::is_pointer<Value>::value>::type> {
+    static const std::uint32_t format = 1;
+
+    static void checksum(LazyFlatSetChecksum& checksum, const Value* data, std::size_t count) {
+        checksum.update(data, count * sizeof(Value));
+    }
+
+    static void write(std::ostream& stream, const Value* data, std::size_t count) {
+        stream.write(reinterpret_cast<const char*>(data), count * sizeof(Value));
+    }
+
+    // the count comes from the stream so it is checked against the bytes left in a seekable stream before
+    // the values are read in one go, otherwise the collection only grows as values arrive; a chunk is a
+    // multiple of 8 bytes so the checksum matches one taken over all of the values at once
+    template <class Collection>
+    static bool read(std::istream& stream, Collection& coll, std::uint64_t count, LazyFlatSetChecksum& checksum) {
+        const auto remaining = LazyFlatSetStreamLength::remaining(stream);
+        if (count > coll.max_size() || (remaining >= 0 && count > static_cast<std::uint64_t>(remaining) / sizeof(Value))) {
+            return false;
+        }
+
+        const std::uint64_t chunk = remaining >= 0 ? count : 1 << 16;
+        for (std::uint64_t done = 0; done < count; done += chunk) {
+            const auto size = static_cast<std::size_t>(std::min(count - done, chunk));
+            coll.resize(coll.size() + size);
+            auto data = coll.data() + coll.size() - size;
+            if (!stream.read(reinterpret_cast<char*>(data), size * sizeof(Value))) {
+                return false;
+            }
+
+            checksum.update(data, size * sizeof(Value));
+        }
+
+        return true;
+    }
+};
+
+template <class Char, class Traits, class Alloc>
+struct LazyFlatSetSerializer<std::basic_string<Char, Traits, Alloc>> {
+    using string_type = std::basic_string<Char, Traits, Alloc>;
+
+    static const std::uint32_t format = 2;
+
+    static void checksum(LazyFlatSetChecksum& checksum, const string_type* data, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            const std::uint64_t length = data[i].size();
+            checksum.update(&length, sizeof(length));
+            checksum.update(data[i].data(), length * sizeof(Char));
+        }
+    }
+
+    static void write(std::ostream& stream, const string_type* data, std::size_t count) {
+        for (std::size_t i = 0; i < count && stream; ++i) {
+            const std::uint64_t length = data[i].size();
+            stream.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            stream.write(reinterpret_cast<const char*>(data[i].data()), length * sizeof(Char));
+        }
+    }
+
+    template <class Collection>
+    static bool read(std::istream& stream, Collection& coll, std::uint64_t count, LazyFlatSetChecksum& checksum) {
+        // as with trivial values the count and lengths are not trusted, each value takes at least its length
+        // so the count is checked against what is left of a seekable stream and space is only added as data arrives
+        const auto remaining = LazyFlatSetStreamLength::remaining(stream);
+        if (count > coll.max_size() || (remaining >= 0 && count > static_cast<std::uint64_t>(remaining) / sizeof(std::uint64_t))) {
+            return false;
+        }
+
+        const std::uint64_t chunk = 1 << 16;
+        if (remaining >= 0) {
+            coll.reserve(static_cast<std::size_t>(count));
+        }
+
+        for (std::uint64_t i = 0; i < count; ++i) {
+            std::uint64_t length = 0;
+            if (!stream.read(reinterpret_cast<char*>(&length), sizeof(length)) || length > string_type().max_size() ||
+                    (remaining >= 0 && length > static_cast<std::uint64_t>(remaining) / sizeof(Char))) {
+                return false;
+            }
+
+            checksum.update(&length, sizeof(length));
+
+            string_type value;
+            for (std::uint64_t done = 0; done < length; done += chunk) {
+                const auto size = static_cast<std::size_t>(std::min(length - done, chunk));
+                value.resize(value.size() + size);
+                if (!stream.read(reinterpret_cast<char*>(&value[done]), size * sizeof(Char))) {
+                    return false;
+                }
+
+                checksum.update(&value[done], size * sizeof(Char));
+            }
+
+            coll.push_back(std::move(value));
+        }
+
+        return true;
+    }
+};
+
+/**
+ * The header written by LazyFlatSet::serialize(). The values are in ascending order under the set's
+ * Less without duplicates (order is 1, other values are reserved) and the checksum covers the
+ * values as the serializer wrote them. Like snapshots, streams use the machine's byte order.
+**/
+struct LazyFlatSetStreamHeader {
+    static const std::uint32_t currentVersion = 1;
+    static const std::uint32_t ascending = 1;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t format;
+    std::uint32_t valueSize;
+    std::uint32_t order;
+    std::uint64_t count;
+    std::uint64_t checksum;
+};
+
+template <class Value, class Less = std::less<Value>, class Equal = std::equal_to<Value>, class Sort = LazyFlatSetQuickSort<Value, Less>, class Alloc = std::allocator<Value>, bool IsPointer = false, class Filter = LazyFlatSetNoFilter<Value>, class Stats = LazyFlatSetNoStats>
+class LazyFlatSet {
+public:
+    template <class T> struct is_shared_ptr : std::false_type {};
+    template <class T> struct is_shared_ptr<std::shared_ptr<T> > : std::true_type {};
+    
+    template <class T> struct is_pointer : std::conditional<IsPointer || std::is_pointer<T>::value || is_shared_ptr<T>::value, std::true_type, std::false_type>::type {};
+    
+    using base_collection = typename LazyFlatSetCollection<Value, Alloc>::type;
+    using size_type = typename base_collection::size_type;
+    using iterator = typename base_collection::iterator;
+    using const_iterator = typename base_collection::const_iterator;
+    using value_type = Value;
+    using value_type_ptr = typename std::conditional<is_pointer<value_type>::value, value_type, value_type*>::type;
+    using reference = typename std::conditional<std::is_fundamental<value_type>::value || std::is_pointer<value_type>::value, value_type, value_type&>::type;
+    using const_reference = typename std::conditional<std::is_fundamental<value_type>::value || std::is_pointer<value_type>::value, value_type, const value_type&>::type;
+    using less_type = Less;
+    using equal_type = Equal;
+    using sort_type = Sort;
+    using alloc_type = Alloc;
+    using filter_type = Filter;
+    using stats_type = Stats;
+    using compare_type = typename std::function<int(const_reference)>;
+    using erase_type = typename std::function<void(reference)>;
+    using visit_type = typename std::function<void(const_reference)>;
+    
+    enum class insert_hint { no_hint = 0, new_item = 1 };
+    
+    // walks the main collection, the levels, the nursery and the sorted unsorted collection in order by
+    // merging them on the fly
+    class const_sorted_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Value;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Value*;
+        using reference = const Value&;
+        
+        const_sorted_iterator() : current_(nullptr), tier_(0) {}
+        
+        reference operator*() const {
+            return *current_;
+        }
+        
+        pointer operator->() const {
+            return current_;
+        }
+        
+        const_sorted_iterator& operator++() {
+            ++tiers_[tier_].first;
+            select();
+            return *this;
+        }
+        
+        const_sorted_iterator operator++(int) {
+            auto iter = *this;
+            ++*this;
+            return iter;
+        }
+        
+        bool operator==(const const_sorted_iterator& other) const {
+            return current_ == other.current_;
+        }
+        
+        bool operator!=(const const_sorted_iterator& other) const {
+            return current_ != other.current_;
+        }
+        
+    private:
+        friend class LazyFlatSet;
+        
+        using bounds_type = std::pair<const Value*, const Value*>;
+        
+        // each tier is the position and end of a sorted run of values, empty tiers are dropped
+        const_sorted_iterator(const std::vector<bounds_type>& tiers) : current_(nullptr), tier_(0) {
+            for (const auto& tier : tiers) {
+                if (tier.first != tier.second) {
+                    tiers_.push_back(tier);
+                }
+            }
+            select();
+        }
+        
+        void select() {
+            Less less;
+            current_ = nullptr;
+            for (size_type i = 0, size = tiers_.size(); i < size; ++i) {
+                if (tiers_[i].first != tiers_[i].second && (current_ == nullptr || less(*tiers_[i].first, *current_))) {
+                    current_ = tiers_[i].first;
+                    tier_ = i;
+                }
+            }
+        }
+        
+        std::vector<bounds_type> tiers_;
+        const Value* current_;
+        size_type tier_;
+    };
+    
+    // a sorted range over all the values which does not flush the set, the main collection, the levels
+    // and the nursery are walked where they are while the unsorted collection is copied and sorted;
+    // the range is invalidated by any change to the set
+    class sorted_range {
+    public:
+        const_sorted_iterator begin() const {
+            auto tiers = tiers_;
+            tiers.push_back(bounds_type(unsorted_.data(), unsorted_.data() + unsorted_.size()));
+            return const_sorted_iterator(tiers);
+        }
+        
+        const_sorted_iterator end() const {
+            return const_sorted_iterator();
+        }
+        
+        size_type size() const {
+            size_type size = unsorted_.size();
+            for (const auto& tier : tiers_) {
+                size += tier.second - tier.first;
+            }
+            return size;
+        }
+        
+    private:
+        friend class LazyFlatSet;
+        
+        using bounds_type = typename const_sorted_iterator::bounds_type;
+        
+        sorted_range(std::vector<bounds_type>&& tiers, base_collection&& unsorted) :
+                tiers_(std::move(tiers)), unsorted_(std::move(unsorted)) {
+            Sort{}(unsorted_.begin(), unsorted_.end());
+        }
+        
+        std::vector<bounds_type> tiers_;
+        base_collection unsorted_;
+    };
+    
+    LazyFlatSet(unsigned maxUnsortedEntries = 16, unsigned maxNurseryEntries = 1024) : 
+            LazyFlatSet(maxUnsortedEntries, maxNurseryEntries, Alloc()) {
+    }
+    
+    LazyFlatSet(unsigned maxUnsortedEntries, unsigned maxNurseryEntries, const Alloc& alloc) : 
+            LazyFlatSet(maxUnsortedEntries, maxNurseryEntries, alloc, alloc, alloc) {
+    }
+    
+    // each tier takes its own copy of an allocator, the levels and search index use the main collection's
+    LazyFlatSet(unsigned maxUnsortedEntries, unsigned maxNurseryEntries, const Alloc& collAlloc, const Alloc& nurseryAlloc, const Alloc& unsortedAlloc) : 
+            maxUnsortedEntries_(maxUnsortedEntries), maxNurseryEntries_(maxNurseryEntries), 
+            minUnsortedEntries_(maxUnsortedEntries), minNurseryEntries_(maxNurseryEntries), searchIndexEnabled_(false),
+            deferredErase_(false), adaptive_(false), levelGrowth_(8), pool_(nullptr), parallelThreshold_(0), coll_(collAlloc), nursery_(nurseryAlloc), unsorted_(unsortedAlloc),
+            searchIndex_(collAlloc), unsortedHinted_(false), duplicatesRemoved_(0), adaptiveInserts_(0), adaptiveLookups_(0), mergeMoved_(0), mergeShare_(1), unsortedMin_(0), unsortedMax_(0), nurseryFilter_(maxNurseryEntries), unsortedFilter_(maxUnsortedEntries) {
+        unsorted_.reserve(maxUnsortedEntries);
+    }
+    
+    void insert(const value_type& k, insert_hint hint = insert_hint::no_hint) {
+        if (append(k)) {
+            return;
+        }
+        
+        if (hint == insert_hint::no_hint) {
+            auto iter = lower_bound_equals(coll_, k);
+            auto position = level_position(nullptr, search_end);
+            if (iter != coll_.end()) {
+                *iter = k;
+                if (is_pointer<value_type>::value) {
+                    resetSearchIndex();
+                }
+            } else if ((position = search_levels(k)).first != nullptr) {
+                (*position.first)[position.second] = k;
+            } else {
+                iter = lower_bound_equals(nursery_, k);
+                if (iter != nursery_.end()) {
+                    *iter = k;
+                } else {
+                    iter = search_unsorted(unsorted_, k);
+                    if (iter != unsorted_.end()) {
+                        *iter = k;
+                    } else {
+                        if (unsorted_.size() >= maxUnsortedEntries_) {
+                            flushUnsorted();
+                        }
+
+                        unsorted_.push_back(k);
+                        pushedUnsorted();
+                    }
+                }
+            }
+        } else {
+            if (unsorted_.size() >= maxUnsortedEntries_) {
+                flushUnsorted();
+            }
+
+            unsorted_.push_back(k);
+            pushedUnsorted();
+            unsortedHinted_ = true;
+        }
+    }
+    
+    // sorts and deduplicates the batch then merges it straight into the main collection,
+    // where the batch holds equal values the last one wins, as it would with repeated insert() calls
+    template <class InputIt>
+    void insert(InputIt first, InputIt last) {
+        base_collection batch(first, last, coll_.get_allocator());
+        if (batch.size() > 0) {
+            sort(batch);
+            batch.erase(unique_last(batch), batch.end());
+            flush();
+            merge_replace(batch, coll_);
+            buildSearchIndex();
+        }
+    }
+    
+    void insert(std::initializer_list<value_type> values) {
+        insert(values.begin(), values.end());
+    }
+    
+    template <typename... Args>
+    void emplace(Args&&... args) {
+        if (unsorted_.size() >= maxUnsortedEntries_) {
+            flushUnsorted();
+        }
+
+        unsorted_.emplace_back(std::forward<Args>(args)...);
+        pushedUnsorted();
+        
+        auto iter = lower_bound_equals(coll_, unsorted_.back());
+        auto position = level_position(nullptr, search_end);
+        if (iter != coll_.end()) {
+            *iter = std::move(unsorted_.back());
+            unsorted_.pop_back();
+            resetUnsortedFences();
+            if (is_pointer<value_type>::value) {
+                resetSearchIndex();
+            }
+        } else if ((position = search_levels(unsorted_.back())).first != nullptr) {
+            (*position.first)[position.second] = std::move(unsorted_.back());
+            unsorted_.pop_back();
+            resetUnsortedFences();
+        } else {
+            iter = lower_bound_equals(nursery_, unsorted_.back());
+            if (iter != nursery_.end()) {
+                *iter = std::move(unsorted_.back());
+                unsorted_.pop_back();
+                resetUnsortedFences();
+            } else if (unsorted_.size() > 1) {
+                auto newItemIter = unsorted_.end() - 1;
+                
+                iter = search_unsorted(unsorted_, unsorted_.back());
+                if (iter != newItemIter) {
+                    *iter = std::move(unsorted_.back());
+                    unsorted_.pop_back();
+                    resetUnsortedFences();
+                }
+            }
+        }
+    }
+    
+    bool empty() const {
+        return coll_.size() == erased_.size() && levels_size() == 0 && nursery_.empty() && unsorted_.empty();
+    }
+    
+    void clear() {
+        coll_.clear();
+        resetErased();
+        for (auto& level : levels_) {
+            level.clear();
+        }
+        nursery_.clear();
+        unsorted_.clear();
+        unsortedHinted_ = false;
+        resetSearchIndex();
+        nurseryFilter_.clear();
+        unsortedFilter_.clear();
+        mergeShare_ = 1;
+        tune();
+    }
+    
+    void clear_fn(erase_type erase) {
+        flushHinted();
+        compactErased();
+        
+        for (auto i : coll_) {
+            erase(i);
+        }
+        
+        coll_.clear();
+        resetSearchIndex();
+        
+        for (auto& level : levels_) {
+            for (auto i : level) {
+                erase(i);
+            }
+            
+            level.clear();
+        }
+        
+        for (auto i : nursery_) {
+            erase(i);
+        }
+        
+        nursery_.clear();
+        
+        for (auto i : unsorted_) {
+            erase(i);
+        }
+        
+        unsorted_.clear();
+        
+        nurseryFilter_.clear();
+        unsortedFilter_.clear();
+    }
+    
+    void reserve(size_type n) {
+        coll_.reserve(n);
+    }
+    
+    size_type size() const {
+        flushHinted();
+        return (coll_.size() - erased_.size()) + levels_size() + nursery_.size() + unsorted_.size();
+    }
+
+    void shrink_to_fit() {
+        flush();
+        nursery_.shrink_to_fit();
+        coll_.shrink_to_fit();
+    }
+    
+    size_type count(const value_type& k) const {
+        return lookup(k).first != nullptr ? 1 : 0;
+    }   
+    
+    size_type count_fn(compare_type compare) const {
+        return lookup_fn(compare).first != nullptr ? 1 : 0;
+    }
+    
+    bool find(const value_type& k, value_type& v) const {
+        flushHinted();
+        
+        const auto position = lookup(k);
+        if (position.first != nullptr) {
+            v = (*position.first)[position.second];
+        }
+        
+        return position.first != nullptr;
+    }
+        
+    value_type_ptr find_fn(compare_type compare) const {
+        flushHinted();
+        
+        const auto position = lookup_fn(compare);
+        return position.first != nullptr ? getValue(*position.first, position.second, is_pointer<value_type>()) : nullptr;
+    }
+        
+    bool contains(const value_type& k) const {
+        return count(k) != 0;
+    }
+    
+    // heterogeneous lookups, available when Less declares is_transparent and can compare K with
+    // value_type both ways; equality is taken to be equivalence under Less
+    template <class K, class L = Less, class = typename L::is_transparent>
+    size_type count(const K& k) const {
+        return lookup_transparent(k).first != nullptr ? 1 : 0;
+    }
+    
+    template <class K, class L = Less, class = typename L::is_transparent>
+    bool contains(const K& k) const {
+        return count(k) != 0;
+    }
+    
+    template <class K, class L = Less, class = typename L::is_transparent>
+    value_type_ptr find(const K& k) const {
+        flushHinted();
+        
+        const auto position = lookup_transparent(k);
+        return position.first != nullptr ? getValue(*position.first, position.second, is_pointer<value_type>()) : nullptr;
+    }
+    
+    template <class K, class L = Less, class = typename L::is_transparent>
+    size_type erase(const K& k) {
+        size_type count = 0;
+        flushHinted();
+        
+        auto index = search_transparent(coll_, k);
+        auto position = level_position(nullptr, search_end);
+        if (index != search_end) {
+            eraseAt(index);
+            count = 1;
+        } else if ((position = search_levels_transparent(k)).first != nullptr) {
+            position.first->erase(position.first->begin() + position.second);
+            count = 1;
+        } else {
+            index = search_transparent(nursery_, k);
+            if (index != search_end) {
+                nursery_.erase(nursery_.begin() + index);
+                count = 1;
+            } else {
+                index = search_unsorted_transparent(unsorted_, k);
+                if (index != search_end) {
+                    unsorted_.erase(unsorted_.begin() + index);
+                    resetUnsortedFences();
+                    count = 1;
+                }
+            }
+        }
+        
+        return count;
+    }
+    
+    const_reference operator[](size_type n) const {
+        flush();
+        return coll_[n];
+    }
+    
+    sorted_range sorted() const {
+        flushHinted();
+        compactErased();
+        
+        std::vector<bounds_type> tiers = { bounds(coll_), bounds(nursery_) };
+        for (const auto& level : levels_) {
+            tiers.push_back(bounds(level));
+        }
+        
+        return sorted_range(std::move(tiers), base_collection(unsorted_));
+    }
+    
+    // the values in [lo, hi) in sorted order, like sorted() the set is not flushed
+    sorted_range range(const value_type& lo, const value_type& hi) const {
+        return make_range(lo, hi, false);
+    }
+    
+    sorted_range equal_range(const value_type& k) const {
+        return make_range(k, k, true);
+    }
+    
+    size_type count_range(const value_type& lo, const value_type& hi) const {
+        flushHinted();
+        compactErased();
+        auto collBounds = bounds(coll_, lo, hi, false);
+        auto nurseryBounds = bounds(nursery_, lo, hi, false);
+        
+        auto less = compare_less();
+        size_type count = (collBounds.second - collBounds.first) + (nurseryBounds.second - nurseryBounds.first);
+        for (const auto& level : levels_) {
+            auto levelBounds = bounds(level, lo, hi, false);
+            count += levelBounds.second - levelBounds.first;
+        }
+        
+        for (const auto& v : unsorted_) {
+            if (!less(v, lo) && less(v, hi)) {
+                ++count;
+            }
+        }
+        
+        return count;
+    }
+    
+    void for_each_in_range(const value_type& lo, const value_type& hi, visit_type visit) const {
+        auto values = range(lo, hi);
+        for (auto iter = values.begin(), end = values.end(); iter != end; ++iter) {
+            visit(*iter);
+        }
+    }
+    
+    // finds the smallest value not less than k
+    bool lower_bound(const value_type& k, value_type& v) const {
+        return first_bound(k, v, false);
+    }
+    
+    // finds the smallest value greater than k
+    bool upper_bound(const value_type& k, value_type& v) const {
+        return first_bound(k, v, true);
+    }
+    
+    const_iterator cbegin() const {
+        flush();
+        return coll_.cbegin();
+    }
+    
+    const_iterator cend() const {
+        flush();
+        return coll_.cend();
+    }    
+    
+    const value_type* data() const {
+        flush();
+        return coll_.data();
+    }
+    
+    size_type erase(const value_type& k) {
+        size_type count = 0;
+        flushHinted();
+        
+        auto iter = lower_bound_equals(coll_, k);
+        auto position = level_position(nullptr, search_end);
+        if (iter != coll_.end()) {
+            eraseAt(iter - coll_.begin());
+            count = 1;
+        } else if ((position = search_levels(k)).first != nullptr) {
+            position.first->erase(position.first->begin() + position.second);
+            count = 1;
+        } else {
+            iter = lower_bound_equals(nursery_, k);
+            if (iter != nursery_.end()) {
+                nursery_.erase(iter);
+                count = 1;
+            } else {
+                iter = search_unsorted(unsorted_, k);
+                if (iter != unsorted_.end()) {
+                    unsorted_.erase(iter);
+                    resetUnsortedFences();
+                    count = 1;
+                }
+            }
+        }
+        
+        return count;
+    }
+    
+    size_type erase_fn(compare_type compare, erase_type erase = nullptr) {
+        size_type count = 0;
+        flushHinted();
+        
+        // the erase callback may free the value so it can't be left in place as a tombstone
+        if (erase != nullptr) {
+            compactErased();
+        }
+        
+        auto index = search(coll_, compare);
+        auto position = level_position(nullptr, search_end);
+        if (index != search_end) {
+            if (erase != nullptr) {
+                erase(coll_[index]);
+                coll_.erase(coll_.begin() + index);
+                resetSearchIndex();
+            } else {
+                eraseAt(index);
+            }
+            count = 1;
+        } else if ((position = search_levels_fn(compare)).first != nullptr) {
+            if (erase != nullptr) {
+                erase((*position.first)[position.second]);
+            }
+            position.first->erase(position.first->begin() + position.second);
+            count = 1;
+        } else {
+            index = search(nursery_, compare);
+            if (index != search_end) {
+                if (erase != nullptr) {
+                    erase(nursery_[index]);
+                }
+                nursery_.erase(nursery_.begin() + index);
+                count = 1;
+            } else {
+                index = search_unsorted(unsorted_, compare);
+                if (index != search_end) {
+                    if (erase != nullptr) {
+                        erase(unsorted_[index]);
+                    }
+                    unsorted_.erase(unsorted_.begin() + index);
+                    resetUnsortedFences();
+                    count = 1;
+                }
+            }
+        }
+        
+        return count;
+    }
+    
+    // removes every value matching the predicate, each tier is compacted in a single pass
+    template <class Predicate>
+    size_type erase_if(Predicate pred, erase_type erase = nullptr) {
+        flushHinted();
+        compactErased();
+        
+        auto count = erase_matching(coll_, 0, coll_.size(), pred, erase) + erase_matching(nursery_, 0, nursery_.size(), pred, erase);
+        for (auto& level : levels_) {
+            count += erase_matching(level, 0, level.size(), pred, erase);
+        }
+        
+        return count + erase_matching(unsorted_, 0, unsorted_.size(), pred, erase);
+    }
+    
+    // removes a batch of keys, which need not be sorted, in a single pass over each tier
+    template <class InputIt, class = typename std::enable_if<!std::is_convertible<InputIt, value_type>::value>::type>
+    size_type erase(InputIt first, InputIt last, erase_type erase = nullptr) {
+        base_collection keys(first, last, coll_.get_allocator());
+        if (keys.empty()) {
+            return 0;
+        }
+        
+        sort(keys);
+        keys.erase(unique_last(keys), keys.end());
+        flushHinted();
+        compactErased();
+        
+        auto less = compare_less();
+        Equal equal;
+        size_type count = 0;
+        
+        for (auto coll : sorted_tiers()) {
+            // both the tier and the keys are sorted so the matching walks them together
+            auto key = keys.cbegin();
+            auto match = [&](const value_type& v) {
+                while (key != keys.cend() && less(*key, v)) {
+                    ++key;
+                }
+                return key != keys.cend() && equal(*key, v);
+            };
+            
+            const auto lo = lower_bound(*coll, keys.front()) - coll->begin();
+            const auto hi = upper_bound(*coll, keys.back()) - coll->begin();
+            count += erase_matching(*coll, lo, hi, match, erase);
+        }
+        
+        return count + erase_matching(unsorted_, 0, unsorted_.size(), [&](const value_type& v) {
+            auto iter = std::lower_bound(keys.cbegin(), keys.cend(), v, less);
+            return iter != keys.cend() && equal(*iter, v);
+        }, erase);
+    }
+    
+    // removes the values in [lo, hi)
+    size_type erase(const value_type& lo, const value_type& hi, erase_type erase = nullptr) {
+        flushHinted();
+        compactErased();
+        
+        size_type count = 0;
+        auto all = [](const value_type&) { return true; };
+        
+        for (auto coll : sorted_tiers()) {
+            const auto collBounds = bounds(*coll, lo, hi, false);
+            count += erase_matching(*coll, collBounds.first - coll->data(), collBounds.second - coll->data(), all, erase);
+        }
+        
+        auto less = compare_less();
+        return count + erase_matching(unsorted_, 0, unsorted_.size(), [&](const value_type& v) {
+            return !less(v, lo) && less(v, hi);
+        }, erase);
+    }
+    
+    // when enabled a small cache friendly index over the main collection is built after each
+    // nursery flush, erasing from the main collection drops the index until the next flush
+    void search_index(bool enable) {
+        searchIndexEnabled_ = enable;
+        if (enable) {
+            buildSearchIndex();
+        } else {
+            resetSearchIndex();
+        }
+    }
+    
+    bool search_index() const {
+        return searchIndexEnabled_;
+    }
+    
+    // when enabled values erased from the main collection are recorded in a small sorted tier of
+    // tombstones rather than moved out, the merge at the next nursery flush skips them or they are
+    // dropped in a single pass once they outnumber the nursery or an eighth of the main collection.
+    // Sets of pointers, shared_ptrs or with IsPointer set always erase in place: the caller is likely
+    // to free what an erased pointer points to while a tombstone is still compared during searches,
+    // and a shared_ptr tombstone would keep its object alive
+    void deferred_erase(bool enable) {
+        deferredErase_ = enable;
+        if (!enable) {
+            compactErased();
+        }
+    }
+    
+    bool deferred_erase() const {
+        return deferredErase_;
+    }
+    
+    // with a non zero count nursery flushes pass through count sorted levels, each growth times the
+    // size of the one above it, before reaching the main collection; a level is only merged into the
+    // next once it outgrows its budget so a large main collection is rewritten far less often
+    void levels(unsigned count, unsigned growth = 8) {
+        flushLevels(true);
+        levels_.assign(count, base_collection(coll_.get_allocator()));
+        levelGrowth_ = std::max(growth, 2u);
+    }
+    
+    unsigned levels() const {
+        return levels_.size();
+    }
+    
+    // when enabled the tiers are resized at each nursery flush from the size of the set, the measured cost
+    // of merging the nursery and the share of lookups that reach the unsorted tier (see tune()), rather
+    // than staying at the sizes given to the constructor, which become the minimum sizes. Lookups are
+    // counted so like inserts they must not be made concurrently. Values arriving in ascending order are
+    // appended straight to the main collection while the other tiers are empty
+    void adaptive(bool enable) {
+        adaptive_ = enable;
+        tune();
+    }
+    
+    bool adaptive() const {
+        return adaptive_;
+    }
+    
+    // when enabled sorts and in place merges of at least threshold values are split into pieces which
+    // run on the pool's threads, smaller ones stay on the calling thread; without a pool the shared
+    // pool is used. A parallel merge holds up to half of the merged values in scratch space while it
+    // runs and a parallel sort holds a copy of the sorted values
+    void parallel(bool enable, size_type threshold = 1 << 20, LazyFlatSetThreadPool* pool = nullptr) {
+        pool_ = enable ? (pool != nullptr ? pool : &LazyFlatSetThreadPool::shared()) : nullptr;
+        parallelThreshold_ = std::max<size_type>(threshold, 2);
+    }
+    
+    bool parallel() const {
+        return pool_ != nullptr;
+    }
+    
+    size_type parallel_threshold() const {
+        return parallelThreshold_;
+    }
+    
+    unsigned max_unsorted_entries() const {
+        return maxUnsortedEntries_;
+    }
+    
+    unsigned max_nursery_entries() const {
+        return maxNurseryEntries_;
+    }
+    
+    // the number of values inserted with insert_hint::new_item that turned out to be in the set
+    // already, each replaced the value it duplicated when the unsorted collection was flushed
+    size_type duplicates_removed() const {
+        return duplicatesRemoved_;
+    }
+    
+    // the counters recorded by the Stats policy, all zero with the default LazyFlatSetNoStats
+    LazyFlatSetStatistics stats() const {
+        return stats_.get();
+    }
+    
+    void reset_stats() {
+        stats_.reset();
+    }
+    
+    // the bytes used by the nursery and unsorted tier filters
+    size_type filter_memory() const {
+        return nurseryFilter_.memory() + unsortedFilter_.memory();
+    }
+    
+    // set algebra between two flushed sets, each a linear merge or, when one set is far smaller than
+    // the other, a walk over the smaller one galloping through the larger; where a value is in both
+    // sets the value from this set is used. The sorted range overloads take unique values sorted by
+    // Less, ranges given as pointers use the same algorithms as sets while other iterators are merged
+    LazyFlatSet set_union(const LazyFlatSet& other) const {
+        other.flush();
+        return set_union(other.coll_.data(), other.coll_.data() + other.coll_.size());
+    }
+    
+    template <class InputIt>
+    LazyFlatSet set_union(InputIt first, InputIt last) const {
+        flush();
+        auto result = make_result();
+        set_union(first, last, result.coll_, std::is_same<InputIt, const value_type*>());
+        return result;
+    }
+    
+    LazyFlatSet set_intersection(const LazyFlatSet& other) const {
+        other.flush();
+        return set_intersection(other.coll_.data(), other.coll_.data() + other.coll_.size());
+    }
+    
+    template <class InputIt>
+    LazyFlatSet set_intersection(InputIt first, InputIt last) const {
+        flush();
+        auto result = make_result();
+        set_intersection(first, last, result.coll_, std::is_same<InputIt, const value_type*>());
+        return result;
+    }
+    
+    // the values in this set but not in other
+    LazyFlatSet set_difference(const LazyFlatSet& other) const {
+        other.flush();
+        return set_difference(other.coll_.data(), other.coll_.data() + other.coll_.size());
+    }
+    
+    template <class InputIt>
+    LazyFlatSet set_difference(InputIt first, InputIt last) const {
+        flush();
+        auto result = make_result();
+        set_difference(first, last, result.coll_, std::is_same<InputIt, const value_type*>());
+        return result;
+    }
+    
+    // the values in exactly one of the sets
+    LazyFlatSet set_symmetric_difference(const LazyFlatSet& other) const {
+        other.flush();
+        return set_symmetric_difference(other.coll_.cbegin(), other.coll_.cend());
+    }
+    
+    template <class InputIt>
+    LazyFlatSet set_symmetric_difference(InputIt first, InputIt last) const {
+        flush();
+        auto result = make_result();
+        std::set_symmetric_difference(coll_.cbegin(), coll_.cend(), first, last, std::back_inserter(result.coll_), compare_less());
+        return result;
+    }
+    
+    // true when every value in other is also in this set
+    bool includes(const LazyFlatSet& other) const {
+        other.flush();
+        return includes(other.coll_.data(), other.coll_.data() + other.coll_.size());
+    }
+    
+    template <class InputIt>
+    bool includes(InputIt first, InputIt last) const {
+        flush();
+        return includes(first, last, std::is_same<InputIt, const value_type*>());
+    }
+    
+    // writes the flushed values to a snapshot file which MappedLazyFlatSet can map, only sets of
+    // trivially copyable values which aren't pointers can be saved
+    bool save(const std::string& path) const {
+        flush();
+        return LazyFlatSetSnapshotHeader::write<Value>(path, coll_.data(), coll_.data() + coll_.size(), coll_.size());
+    }
+    
+    // writes a header and the flushed values to the stream, the values are written by
+    // LazyFlatSetSerializer which handles trivially copyable values and strings
+    bool serialize(std::ostream& stream) const {
+        using serializer = LazyFlatSetSerializer<Value>;
+        flush();
+        
+        LazyFlatSetChecksum checksum;
+        serializer::checksum(checksum, coll_.data(), coll_.size());
+        
+        LazyFlatSetStreamHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "RSLFSTRM", sizeof(header.magic));
+        header.version = LazyFlatSetStreamHeader::currentVersion;
+        header.format = serializer::format;
+        header.valueSize = sizeof(Value);
+        header.order = LazyFlatSetStreamHeader::ascending;
+        header.count = coll_.size();
+        header.checksum = checksum.value();
+        
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        serializer::write(stream, coll_.data(), coll_.size());
+        return static_cast<bool>(stream);
+    }
+    
+    // replaces the contents of the set with the values written by serialize(); the values are read
+    // straight into the main collection and trusted to be sorted unless validate is set, in which
+    // case the order is checked as well as the checksum. On failure the set is left empty
+    bool deserialize(std::istream& stream, bool validate = false) {
+        using serializer = LazyFlatSetSerializer<Value>;
+        clear();
+        
+        LazyFlatSetStreamHeader header;
+        LazyFlatSetChecksum checksum;
+        auto valid = stream.read(reinterpret_cast<char*>(&header), sizeof(header)) && std::memcmp(header.magic, "RSLFSTRM", sizeof(header.magic)) == 0 &&
+            header.version == LazyFlatSetStreamHeader::currentVersion && header.format == serializer::format && header.valueSize == sizeof(Value) &&
+            header.order == LazyFlatSetStreamHeader::ascending && readValues(stream, header.count, checksum) && checksum.value() == header.checksum;
+        
+        if (valid && validate) {
+            auto less = compare_less();
+            valid = std::adjacent_find(coll_.cbegin(), coll_.cend(), [&](const value_type& a, const value_type& b) { return !less(a, b); }) == coll_.cend();
+        }
+        
+        if (!valid) {
+            clear();
+            return false;
+        }
+        
+        buildSearchIndex();
+        tune();
+        return true;
+    }
+    
+    void copy(std::vector<Value>& coll, bool sort = true) const {
+        if (sort) {
+            flush();
+        } else {
+            flushHinted();
+            compactErased();
+        }
+        
+        const auto newSize = coll.size() + coll_.size() + levels_size() + nursery_.size() + unsorted_.size();
+        coll.reserve(newSize);
+        
+        coll.insert(coll.end(), coll_.cbegin(), coll_.cend());
+        for (const auto& level : levels_) {
+            coll.insert(coll.end(), level.cbegin(), level.cend());
+        }
+        coll.insert(coll.end(), nursery_.cbegin(), nursery_.cend());
+        coll.insert(coll.end(), unsorted_.cbegin(), unsorted_.cend());        
+    }
+    
+private:
+    const size_type search_end = -1;
+    
+    using compare_less_type = typename Stats::template less_type<Less>;
+    
+    compare_less_type compare_less() const {
+        return stats_.template less<Less>();
+    }
+    
+    // reads the values of a stream into the main collection, a stream too large to hold is bad input
+    // rather than an error so the allocation failure is reported as a failed read
+    bool readValues(std::istream& stream, std::uint64_t count, LazyFlatSetChecksum& checksum) {
+        try {
+            return LazyFlatSetSerializer<Value>::read(stream, coll_, count, checksum);
+        } catch (const std::bad_alloc&) {
+            return false;
+        }
+    }
+    
+    void recordMerge(std::uint64_t LazyFlatSetStatistics::* path, size_type moved) const {
+        stats_.count(path);
+        stats_.moved(moved);
+        if (adaptive_) {
+            mergeMoved_ += moved;
+        }
+    }
+    
+    void sort(base_collection& coll) const {
+        if (useParallel(coll.size())) {
+            sortParallel(coll);
+        } else {
+            Sort{}(coll.begin(), coll.end());
+        }
+    }
+    
+    bool useParallel(size_type size) const {
+        return pool_ != nullptr && size >= parallelThreshold_ && pool_->concurrency() > 1;
+    }
+    
+    // sorts a run of the collection on each thread with Sort then merges pairs of runs until one is left,
+    // the values go back and forth between the collection and a scratch copy and each merge is split
+    // into a piece per thread
+    void sortParallel(base_collection& coll) const {
+        const size_type pieces = pool_->concurrency();
+        std::vector<size_type> runs;
+        for (size_type i = 0; i <= pieces; ++i) {
+            runs.push_back(coll.size() * i / pieces);
+        }
+        
+        pool_->run(pieces, [&](std::size_t i) {
+            Sort{}(coll.begin() + runs[i], coll.begin() + runs[i + 1]);
+        });
+        
+        struct segment {
+            size_type a, aLast, b, bLast, out;
+        };
+        
+        base_collection scratch(std::make_move_iterator(coll.begin()), std::make_move_iterator(coll.end()), coll.get_allocator());
+        auto from = &scratch;
+        auto to = &coll;
+        while (runs.size() > 2) {
+            std::vector<segment> segments;
+            std::vector<size_type> merged;
+            for (size_type r = 0; r + 1 < runs.size(); r += 2) {
+                const auto a = runs[r], b = runs[r + 1], last = r + 2 < runs.size() ? runs[r + 2] : b;
+                for (size_type i = 0; i < pieces; ++i) {
+                    const auto k = (last - a) * i / pieces, kLast = (last - a) * (i + 1) / pieces;
+                    const auto aSplit = LazyFlatSetMergePath::split(from->begin() + a, b - a, from->begin() + b, last - b, k, Less{});
+                    const auto aSplitLast = LazyFlatSetMergePath::split(from->begin() + a, b - a, from->begin() + b, last - b, kLast, Less{});
+                    segments.push_back({ a + aSplit, a + aSplitLast, b + k - aSplit, b + kLast - aSplitLast, a + k });
+                }
+                merged.push_back(a);
+            }
+            merged.push_back(runs.back());
+            
+            pool_->run(segments.size(), [&](std::size_t i) {
+                const auto& s = segments[i];
+                std::merge(std::make_move_iterator(from->begin() + s.a), std::make_move_iterator(from->begin() + s.aLast),
+                    std::make_move_iterator(from->begin() + s.b), std::make_move_iterator(from->begin() + s.bLast), to->begin() + s.out, Less{});
+            });
+            
+            std::swap(from, to);
+            runs.swap(merged);
+        }
+        
+        if (from != &coll) {
+            coll.swap(scratch);
+        }
+    }
+
+    iterator lower_bound(base_collection& coll, const value_type& k) const {
+        return coll.begin() + LazyFlatSetSortedSearch<Value, compare_less_type>::lower_bound(coll.data(), coll.size(), k, compare_less());
+    }
+    
+    iterator lower_bound_equals(base_collection& coll, const value_type& k) const {
+        auto less = compare_less();
+        if (coll.empty() || less(k, coll.front()) || less(coll.back(), k) || (&coll == &nursery_ && !nurseryFilter_.may_contain(k))) {
+            return coll.end();
+        }
+        
+        auto iter = &coll == &coll_ && searchIndex_.size() > 0 ? lower_bound_indexed(k) : lower_bound(coll, k);
+        return iter != coll.end() && Equal{}(*iter, k) && !erased(coll, iter - coll.begin()) ? iter : coll.end();
+    }
+    
+    size_type search_equals(base_collection& coll, const value_type& k) const {
+        auto iter = lower_bound_equals(coll, k);
+        return iter != coll.end() ? iter - coll.begin() : search_end;
+    }
+    
+    iterator upper_bound(base_collection& coll, const value_type& k) const {
+        return std::upper_bound(coll.begin(), coll.end(), k, compare_less());
+    }
+    
+    iterator upper_bound_equals(base_collection& coll, const value_type& k) const {
+        auto iter = upper_bound(coll, k);
+        return iter != coll.end() && Equal{}(*iter, k) ? iter : coll.end();
+    }
+    
+    size_type search(base_collection& coll, compare_type compare) const {
+        const auto size = coll.size();
+        
+        if (size > 0) {
+            size_type min = 0;
+            size_type max = size - 1;
+            const auto data = coll.data();
+
+            while (max != search_end && max >= min) {
+                auto mid = ((max - min) / 2) + min;
+
+                const auto& item = data[mid];
+                auto diff = compare(item);
+                if (diff == 0) {
+                    return erased(coll, mid) ? search_end : mid;
+                } else if (diff < 0) {
+                    max = mid - 1;
+                } else {
+                    min = mid + 1;
+                }
+            }
+        }
+        
+        return search_end;
+    }
+    
+    size_type search_unsorted(base_collection& coll, compare_type compare) const {
+        const auto data = coll.data();
+        
+        for (size_type i = 0, size = coll.size(); i < size; ++i) {
+            if (compare(data[i]) == 0) {
+                return i;
+            }
+        }
+        
+        return search_end;
+    }
+    
+    using bounds_type = typename sorted_range::bounds_type;
+    
+    static bounds_type bounds(const base_collection& coll) {
+        return bounds_type(coll.data(), coll.data() + coll.size());
+    }
+    
+    // the positions of lo and hi in a sorted collection, hi is included when inclusive is set
+    bounds_type bounds(const base_collection& coll, const value_type& lo, const value_type& hi, bool inclusive) const {
+        auto less = compare_less();
+        const auto data = coll.data();
+        const auto size = coll.size();
+        
+        if (less(hi, lo)) {
+            return bounds_type(data, data);
+        }
+        
+        const auto first = data + LazyFlatSetSortedSearch<Value, compare_less_type>::lower_bound(data, size, lo, less);
+        const auto last = inclusive ? std::upper_bound(first, data + size, hi, less) : 
+            first + LazyFlatSetSortedSearch<Value, compare_less_type>::lower_bound(first, (data + size) - first, hi, less);
+        return bounds_type(first, last);
+    }
+    
+    sorted_range make_range(const value_type& lo, const value_type& hi, bool inclusive) const {
+        flushHinted();
+        compactErased();
+        
+        auto less = compare_less();
+        base_collection unsorted(unsorted_.get_allocator());
+        for (const auto& v : unsorted_) {
+            if (!less(v, lo) && (inclusive ? !less(hi, v) : less(v, hi))) {
+                unsorted.push_back(v);
+            }
+        }
+        
+        std::vector<bounds_type> tiers = { bounds(coll_, lo, hi, inclusive), bounds(nursery_, lo, hi, inclusive) };
+        for (const auto& level : levels_) {
+            tiers.push_back(bounds(level, lo, hi, inclusive));
+        }
+        
+        return sorted_range(std::move(tiers), std::move(unsorted));
+    }
+    
+    bool first_bound(const value_type& k, value_type& v, bool greater) const {
+        flushHinted();
+        compactErased();
+        
+        auto less = compare_less();
+        const value_type* bound = nullptr;
+        
+        for (auto coll : sorted_tiers()) {
+            auto iter = greater ? std::upper_bound(coll->cbegin(), coll->cend(), k, less) : std::lower_bound(coll->cbegin(), coll->cend(), k, less);
+            if (iter != coll->cend() && (bound == nullptr || less(*iter, *bound))) {
+                bound = &*iter;
+            }
+        }
+        
+        for (const auto& i : unsorted_) {
+            if ((greater ? less(k, i) : !less(i, k)) && (bound == nullptr || less(i, *bound))) {
+                bound = &i;
+            }
+        }
+        
+        if (bound != nullptr) {
+            v = *bound;
+        }
+        
+        return bound != nullptr;
+    }
+    
+    template <class K>
+    size_type search_transparent(base_collection& coll, const K& k) const {
+        auto less = compare_less();
+        auto iter = std::lower_bound(coll.begin(), coll.end(), k, less);
+        return iter != coll.end() && !less(k, *iter) && !erased(coll, iter - coll.begin()) ? iter - coll.begin() : search_end;
+    }
+    
+    template <class K>
+    size_type search_unsorted_transparent(base_collection& coll, const K& k) const {
+        auto less = compare_less();
+        const auto data = coll.data();
+        
+        for (size_type i = 0, size = coll.size(); i < size; ++i) {
+            if (!less(data[i], k) && !less(k, data[i])) {
+                return i;
+            }
+        }
+        
+        return search_end;
+    }
+    
+    iterator search_unsorted(base_collection& coll, const value_type& k) const {
+        auto less = compare_less();
+        if (coll.empty() || less(k, coll[unsortedMin_]) || less(coll[unsortedMax_], k) || !unsortedFilter_.may_contain(k)) {
+            return coll.end();
+        }
+        
+        return coll.begin() + LazyFlatSetUnsortedScan<Value, Equal>::find(coll.data(), coll.size(), k);
+    }
+    
+    size_type search_unsorted_equals(base_collection& coll, const value_type& k) const {
+        auto iter = search_unsorted(coll, k);
+        return iter != coll.end() ? iter - coll.begin() : search_end;
+    }
+    
+    void flush() const {
+        compactErased();
+        flushUnsorted();
+        flushNursery();
+        flushLevels(true);
+    }
+
+    void flushUnsorted() const {
+        const auto unsortedSize = unsorted_.size();
+        if (unsortedSize > 0) {
+            if ((nursery_.size() + unsortedSize) > maxNurseryEntries_) {
+                flushNursery();
+            }
+
+            for (const auto& k : unsorted_) {
+                nurseryFilter_.insert(k);
+            }
+            
+            if (unsortedHinted_) {
+                removeDuplicates();
+            } else {
+                sort(unsorted_);
+                merge(unsorted_, nursery_);
+            }
+            stats_.count(&LazyFlatSetStatistics::unsorted_flushes);
+            
+            unsorted_.clear();
+            unsortedFilter_.clear();
+        }
+    }
+    
+    // values inserted with insert_hint::new_item may duplicate values held elsewhere, they are
+    // flushed before anything that could see the duplicates, such as size(), find() and erase()
+    void flushHinted() const {
+        if (unsortedHinted_) {
+            flushUnsorted();
+        }
+    }
+    
+    // merges the unsorted collection into the nursery when it may hold duplicates; a stable sort keeps
+    // equal values in insert order so the newest of each run survives and then replaces any equal value
+    // in the main collection, the levels or the nursery
+    void removeDuplicates() const {
+        const auto unsortedSize = unsorted_.size();
+        std::stable_sort(unsorted_.begin(), unsorted_.end(), compare_less());
+        unsorted_.erase(unique_last(unsorted_), unsorted_.end());
+        
+        auto out = unsorted_.begin();
+        for (auto iter = unsorted_.begin(); iter != unsorted_.end(); ++iter) {
+            auto collIter = lower_bound_equals(coll_, *iter);
+            auto position = level_position(nullptr, search_end);
+            if (collIter != coll_.end()) {
+                *collIter = std::move(*iter);
+                if (is_pointer<value_type>::value) {
+                    resetSearchIndex();
+                }
+            } else if ((position = search_levels(*iter)).first != nullptr) {
+                (*position.first)[position.second] = std::move(*iter);
+            } else {
+                if (out != iter) {
+                    *out = std::move(*iter);
+                }
+                ++out;
+            }
+        }
+        unsorted_.erase(out, unsorted_.end());
+        
+        const auto nurserySize = nursery_.size();
+        if (unsorted_.size() > 0) {
+            merge_replace(unsorted_, nursery_);
+        }
+        
+        duplicatesRemoved_ += unsortedSize - (nursery_.size() - nurserySize);
+        unsortedHinted_ = false;
+    }
+    
+    void flushNursery() const {
+        if (nursery_.size() > 0) {
+            stats_.count(&LazyFlatSetStatistics::nursery_flushes);
+            const auto moved = mergeMoved_;
+            if (levels_.empty()) {
+                mergeMain(nursery_);
+                buildSearchIndex();
+            } else {
+                merge(nursery_, levels_.front());
+                flushLevels(false);
+            }
+            
+            observeFlush(mergeMoved_ - moved);
+            nursery_.clear();
+            nurseryFilter_.clear();
+            tune();
+        }
+    }
+    
+    // resizes the tiers in adaptive mode from what the set has observed since the last flush. Each insert
+    // scans the unsorted values, so do lookups that miss the sorted tiers, each batch of u unsorted values
+    // is merged into the nursery and each nursery of v values into the m values below it; with r such
+    // lookups per insert the cost per insert, u(1 + r) + v/u + m/v, is least with u the cube root of
+    // m/(1 + r)^2 and v = u^2(1 + r). m is taken from the values the recent nursery flushes moved as a share
+    // of the values below the nursery, so insert order counts: shuffled and descending values move nearly
+    // all of them while values arriving in ascending runs are appended after most of them. A tier
+    // grows as soon as it is called for but only shrinks, never below the size given to the constructor,
+    // once it is adaptiveShrink times larger than called for so a set on a boundary keeps its sizes
+    void tune() const {
+        if (adaptive_) {
+            const auto lookups = static_cast<double>(adaptiveLookups_) / std::max<size_type>(adaptiveInserts_, 1);
+            const auto cost = mergeShare_ * static_cast<double>(coll_.size() + levels_size());
+            const auto root = std::cbrt(cost / ((1 + lookups) * (1 + lookups)));
+            adaptiveInserts_ = adaptiveLookups_ = 0;
+            
+            const unsigned maxUnsorted = maxAdaptiveUnsortedEntries;
+            const auto unsortedEntries = std::max(static_cast<unsigned>(std::min<double>(root, maxUnsorted)), minUnsortedEntries_);
+            if (unsortedEntries > maxUnsortedEntries_ || unsortedEntries * adaptiveShrink <= maxUnsortedEntries_) {
+                maxUnsortedEntries_ = unsortedEntries;
+                unsorted_.reserve(maxUnsortedEntries_);
+                unsortedFilter_ = Filter(maxUnsortedEntries_);
+                for (const auto& k : unsorted_) {
+                    unsortedFilter_.insert(k);
+                }
+            }
+            
+            const unsigned maxNursery = maxAdaptiveNurseryEntries;
+            const auto nurseryEntries = std::max(static_cast<unsigned>(std::min<double>(root * root * (1 + lookups), maxNursery)), minNurseryEntries_);
+            if (nurseryEntries > maxNurseryEntries_ || nurseryEntries * adaptiveShrink <= maxNurseryEntries_) {
+                maxNurseryEntries_ = nurseryEntries;
+                nurseryFilter_ = Filter(maxNurseryEntries_);
+                for (const auto& k : nursery_) {
+                    nurseryFilter_.insert(k);
+                }
+            }
+        }
+    }
+    
+    // records the values a nursery flush moved as a share of the values below the nursery, averaged over
+    // the recent flushes
+    void observeFlush(std::uint64_t moved) const {
+        const auto size = coll_.size() + levels_size();
+        if (adaptive_ && size > 0) {
+            const auto share = std::min(1.0, static_cast<double>(moved) / static_cast<double>(size));
+            mergeShare_ = ((mergeShare_ * 3) + share) / 4;
+        }
+    }
+    
+    static constexpr unsigned maxAdaptiveUnsortedEntries = 256;
+    static constexpr unsigned maxAdaptiveNurseryEntries = 1 << 20;
+    static constexpr unsigned adaptiveShrink = 4;
+    
+    // in adaptive mode appends k to the main collection when it is past the end of it and the
+    // other tiers are empty, so ascending input skips the tiers entirely
+    bool append(const value_type& k) {
+        if (adaptive_ && unsorted_.empty() && nursery_.empty() && levels_size() == 0 && (coll_.empty() || compare_less()(coll_.back(), k))) {
+            coll_.push_back(k);
+            
+            // the appended values fall in the index's last block, which is searched to the end of the
+            // main collection, so the index is only rebuilt once the main collection has doubled
+            if (searchIndexEnabled_ && coll_.size() >= 2 * searchIndex_.size() * searchIndexBlock) {
+                buildSearchIndex();
+            }
+            return true;
+        }
+        
+        return false;
+    }
+    
+    // merges each level that has outgrown its budget into the next one, the last level merges
+    // into the main collection; when collapse is set every level is merged down
+    void flushLevels(bool collapse) const {
+        size_type budget = maxNurseryEntries_;
+        for (size_type i = 0, count = levels_.size(); i < count; ++i) {
+            budget *= levelGrowth_;
+            if (levels_[i].size() > 0 && (collapse || levels_[i].size() > budget)) {
+                stats_.count(&LazyFlatSetStatistics::level_flushes);
+                if (i + 1 < count) {
+                    merge(levels_[i], levels_[i + 1]);
+                } else {
+                    mergeMain(levels_[i]);
+                    buildSearchIndex();
+                }
+                
+                levels_[i].clear();
+            }
+        }
+    }
+    
+    size_type levels_size() const {
+        size_type size = 0;
+        for (const auto& level : levels_) {
+            size += level.size();
+        }
+        return size;
+    }
+    
+    // the main collection, nursery and levels, all of which are sorted
+    std::vector<base_collection*> sorted_tiers() const {
+        std::vector<base_collection*> tiers = { &coll_, &nursery_ };
+        for (auto& level : levels_) {
+            tiers.push_back(&level);
+        }
+        return tiers;
+    }
+    
+    // the collection and index of a value held in one of the tiers
+    using level_position = std::pair<base_collection*, size_type>;
+    
+    // searches the levels from the newest to the oldest, find returns an index into the level or search_end
+    template <class Find>
+    level_position search_levels(Find find) const {
+        for (auto& level : levels_) {
+            const auto index = find(level);
+            if (index != search_end) {
+                return level_position(&level, index);
+            }
+        }
+        
+        return level_position(nullptr, search_end);
+    }
+    
+    level_position search_levels(const value_type& k) const {
+        return search_levels([&](base_collection& level) { return search_equals(level, k); });
+    }
+    
+    level_position search_levels_fn(compare_type compare) const {
+        return search_levels([&](base_collection& level) { return search(level, compare); });
+    }
+    
+    template <class K>
+    level_position search_levels_transparent(const K& k) const {
+        return search_levels([&](base_collection& level) { return search_transparent(level, k); });
+    }
+    
+    // searches the tiers from the oldest to the newest for a lookup, find returns an index into a sorted tier
+    // and findUnsorted one into the unsorted tier, or search_end; the tier answering it is recorded here so
+    // every lookup function is covered by the statistics
+    template <class Find, class FindUnsorted>
+    level_position lookup(Find find, FindUnsorted findUnsorted) const {
+        auto index = find(coll_);
+        if (index != search_end) {
+            stats_.count(&LazyFlatSetStatistics::main_hits);
+            return level_position(&coll_, index);
+        }
+        
+        auto position = search_levels(find);
+        if (position.first != nullptr) {
+            stats_.count(&LazyFlatSetStatistics::level_hits);
+            return position;
+        }
+        
+        index = find(nursery_);
+        if (index != search_end) {
+            stats_.count(&LazyFlatSetStatistics::nursery_hits);
+            return level_position(&nursery_, index);
+        }
+        
+        if (adaptive_) {
+            ++adaptiveLookups_;
+        }
+        
+        index = findUnsorted(unsorted_);
+        if (index != search_end) {
+            stats_.count(&LazyFlatSetStatistics::unsorted_hits);
+            return level_position(&unsorted_, index);
+        }
+        
+        stats_.count(&LazyFlatSetStatistics::misses);
+        return level_position(nullptr, search_end);
+    }
+    
+    level_position lookup(const value_type& k) const {
+        return lookup([&](base_collection& coll) { return search_equals(coll, k); }, 
+            [&](base_collection& coll) { return search_unsorted_equals(coll, k); });
+    }
+    
+    level_position lookup_fn(compare_type compare) const {
+        return lookup([&](base_collection& coll) { return search(coll, compare); }, 
+            [&](base_collection& coll) { return search_unsorted(coll, compare); });
+    }
+    
+    template <class K>
+    level_position lookup_transparent(const K& k) const {
+        return lookup([&](base_collection& coll) { return search_transparent(coll, k); }, 
+            [&](base_collection& coll) { return search_unsorted_transparent(coll, k); });
+    }
+    
+    // extends the unsorted fences and filter to cover the value just added to the back of unsorted_
+    void pushedUnsorted() const {
+        const auto index = unsorted_.size() - 1;
+        if (index == 0) {
+            unsortedMin_ = unsortedMax_ = 0;
+        } else {
+            auto less = compare_less();
+            if (less(unsorted_[index], unsorted_[unsortedMin_])) {
+                unsortedMin_ = index;
+            }
+            if (less(unsorted_[unsortedMax_], unsorted_[index])) {
+                unsortedMax_ = index;
+            }
+        }
+        
+        unsortedFilter_.insert(unsorted_.back());
+        if (adaptive_) {
+            ++adaptiveInserts_;
+        }
+    }
+    
+    // recalculates the unsorted fences after a value is removed, the filter is left as it is
+    void resetUnsortedFences() const {
+        auto less = compare_less();
+        unsortedMin_ = unsortedMax_ = 0;
+        for (size_type i = 1, size = unsorted_.size(); i < size; ++i) {
+            if (less(unsorted_[i], unsorted_[unsortedMin_])) {
+                unsortedMin_ = i;
+            }
+            if (less(unsorted_[unsortedMax_], unsorted_[i])) {
+                unsortedMax_ = i;
+            }
+        }
+    }
+    
+    // removes the values in [first, last) of coll that match, moving the remaining values once
+    template <class Match>
+    size_type erase_matching(base_collection& coll, size_type first, size_type last, Match match, const erase_type& erase) {
+        const auto end = coll.begin() + last;
+        auto result = coll.begin() + first;
+        for (auto iter = result; iter != end; ++iter) {
+            if (match(*iter)) {
+                if (erase != nullptr) {
+                    erase(*iter);
+                }
+            } else {
+                if (result != iter) {
+                    *result = std::move(*iter);
+                }
+                ++result;
+            }
+        }
+        
+        const size_type count = end - result;
+        if (count > 0) {
+            coll.erase(result, end);
+            if (&coll == &coll_) {
+                buildSearchIndex();
+            } else if (&coll == &unsorted_) {
+                resetUnsortedFences();
+            }
+        }
+        
+        return count;
+    }
+    
+    bool erased(const base_collection& coll, size_type index) const {
+        return !erased_.empty() && &coll == &coll_ && std::binary_search(erased_.cbegin(), erased_.cend(), index);
+    }
+    
+    // removes the value at index in the main collection, or in deferred mode adds its index to the sorted
+    // tombstones, which are dropped by the next merge into the main collection or once they outnumber
+    // the nursery or an eighth of the main collection; values which point at what they hold are always
+    // removed at once, see deferred_erase()
+    void eraseAt(size_type index) {
+        if (deferredErase_ && !is_pointer<value_type>::value) {
+            erased_.insert(std::upper_bound(erased_.begin(), erased_.end(), index), index);
+            if (erased_.size() > std::min<size_type>(maxNurseryEntries_, coll_.size() / 8)) {
+                compactErased();
+            }
+        } else {
+            coll_.erase(coll_.begin() + index);
+            resetSearchIndex();
+        }
+    }
+    
+    // drops the tombstoned values from the main collection, moving each run of values between two
+    // tombstones down in one go
+    void compactErased() const {
+        if (!erased_.empty()) {
+            auto out = coll_.begin() + erased_.front();
+            for (size_type i = 0, count = erased_.size(); i < count; ++i) {
+                auto first = coll_.begin() + erased_[i] + 1;
+                auto last = i + 1 < count ? coll_.begin() + erased_[i + 1] : coll_.end();
+                out = std::move(first, last, out);
+            }
+            
+            coll_.erase(out, coll_.end());
+            resetErased();
+            buildSearchIndex();
+        }
+    }
+    
+    // merges the sorted source into the main collection, the source values are moved from. Tombstoned values
+    // are dropped by the merge itself: between the tombstones and the places the source values go in, each run
+    // of the main collection moves by the number of source values before it less the number of tombstones
+    // before it. Runs moving down are moved first from the front, then runs moving up and the source values
+    // from the back, so each value is moved at most once and none is overwritten before it has been moved
+    void mergeMain(base_collection& source) const {
+        if (erased_.empty()) {
+            merge(source, coll_);
+            return;
+        }
+        
+        const size_type size = coll_.size();
+        const size_type count = source.size();
+        const size_type erased = erased_.size();
+        auto less = compare_less();
+        
+        // the index in the main collection each source value goes before
+        std::vector<size_type> positions;
+        positions.reserve(count);
+        const value_type* first = coll_.data();
+        for (const auto& k : source) {
+            first = LazyFlatSetGallop::lower_bound(first, static_cast<const value_type*>(coll_.data() + size), k, less);
+            positions.push_back(first - coll_.data());
+        }
+        
+        struct run {
+            size_type first;
+            size_type last;
+            std::ptrdiff_t shift;
+        };
+        
+        std::vector<run> runs;
+        for (size_type start = 0, k = 0, e = 0; start < size; ) {
+            if (e < erased && erased_[e] == start) {
+                ++e;
+                ++start;
+                continue;
+            }
+            
+            while (k < count && positions[k] <= start) {
+                ++k;
+            }
+            
+            const auto last = std::min(e < erased ? erased_[e] : size, k < count ? positions[k] : size);
+            runs.push_back(run{ start, last, static_cast<std::ptrdiff_t>(k) - static_cast<std::ptrdiff_t>(e) });
+            start = last;
+        }
+        
+        // where each source value ends up
+        for (size_type k = 0, e = 0; k < count; ++k) {
+            while (e < erased && erased_[e] < positions[k]) {
+                ++e;
+            }
+            positions[k] = (positions[k] - e) + k;
+        }
+        
+        if (count > erased) {
+            grow(coll_, source, count - erased, std::is_default_constructible<value_type>());
+        }
+        
+        size_type moved = count;
+        auto data = coll_.begin();
+        for (const auto& r : runs) {
+            if (r.shift < 0) {
+                std::move(data + r.first, data + r.last, data + r.first + r.shift);
+                moved += r.last - r.first;
+            }
+        }
+        
+        auto r = runs.size();
+        for (auto k = count; k > 0 || r > 0; ) {
+            if (k > 0 && (r == 0 || positions[k - 1] > runs[r - 1].first + runs[r - 1].shift)) {
+                --k;
+                data[positions[k]] = std::move(source[k]);
+            } else {
+                --r;
+                if (runs[r].shift > 0) {
+                    std::move_backward(data + runs[r].first, data + runs[r].last, data + runs[r].last + runs[r].shift);
+                    moved += runs[r].last - runs[r].first;
+                }
+            }
+        }
+        
+        coll_.erase(coll_.begin() + ((size + count) - erased), coll_.end());
+        recordMerge(&LazyFlatSetStatistics::inplace_merges, moved);
+        resetErased();
+    }
+    
+    void resetErased() const {
+        erased_.clear();
+    }
+    
+    // the index is an Eytzinger (breadth first) layout of every searchIndexBlock'th value in
+    // the main collection; a search walks the index to find the block then searches inside it
+    static constexpr size_type searchIndexBlock = sizeof(value_type) < 16 ? 64 / sizeof(value_type) : 4;
+    
+    void buildSearchIndex() const {
+        resetSearchIndex();
+        
+        const auto samples = (coll_.size() + searchIndexBlock - 1) / searchIndexBlock;
+        if (searchIndexEnabled_ && samples > 1) {
+            searchIndex_.assign(samples + 1, coll_.front());
+            searchIndexRanks_.resize(samples + 1);
+            buildSearchIndex(0, 1);
+        }
+    }
+    
+    size_type buildSearchIndex(size_type sample, size_type node) const {
+        if (node < searchIndex_.size()) {
+            sample = buildSearchIndex(sample, 2 * node);
+            searchIndex_[node] = coll_[sample * searchIndexBlock];
+            searchIndexRanks_[node] = sample++;
+            sample = buildSearchIndex(sample, (2 * node) + 1);
+        }
+        return sample;
+    }
+    
+    void resetSearchIndex() const {
+        searchIndex_.clear();
+        searchIndexRanks_.clear();
+    }
+    
+    iterator lower_bound_indexed(const value_type& k) const {
+        auto less = compare_less();
+        const auto index = searchIndex_.data();
+        const auto size = searchIndex_.size();
+        
+        size_type node = 1;
+        while (node < size) {
+#if defined(__GNUC__)
+            __builtin_prefetch(index + (node * searchIndexBlock));
+#endif
+            node = (2 * node) + (less(index[node], k) ? 1 : 0);
+        }
+        
+        // strip the right turns taken below the last left turn, that node is the first sample not less than k
+        while (node & 1) {
+            node >>= 1;
+        }
+        node >>= 1;
+        
+        const auto samples = size - 1;
+        const auto sample = node > 0 ? searchIndexRanks_[node] : samples;
+        const auto first = sample > 0 ? (sample - 1) * searchIndexBlock : 0;
+        const auto last = sample < samples ? std::min(coll_.size(), (sample * searchIndexBlock) + 1) : coll_.size();
+        return coll_.begin() + first + LazyFlatSetSortedSearch<Value, compare_less_type>::lower_bound(coll_.data() + first, last - first, k, compare_less());
+    }
+
+    // removes runs of equal values from a sorted collection keeping the last value of each run
+    iterator unique_last(base_collection& coll) const {
+        Equal equal;
+        auto result = coll.begin();
+        for (auto iter = coll.begin(), end = coll.end(); iter != end; ++iter) {
+            if (iter + 1 == end || !equal(*iter, *(iter + 1))) {
+                if (result != iter) {
+                    *result = std::move(*iter);
+                }
+                ++result;
+            }
+        }
+        return result;
+    }
+    
+    // merges the sorted and unique source into target, source values replace equal target values
+    void merge_replace(base_collection& source, base_collection& target) const {
+        auto less = compare_less();
+        if (target.size() == 0 || less(target.back(), source.front())) {
+            target.insert(target.end(), std::make_move_iterator(source.begin()), std::make_move_iterator(source.end()));
+            recordMerge(&LazyFlatSetStatistics::append_merges, source.size());
+        } else if (less(source.back(), target.front())) {
+            target.insert(target.begin(), std::make_move_iterator(source.begin()), std::make_move_iterator(source.end()));
+            recordMerge(&LazyFlatSetStatistics::prepend_merges, target.size());
+        } else {
+            Equal equal;
+            base_collection merged(target.get_allocator());
+            merged.reserve(source.size() + target.size());
+            
+            auto sourceIter = source.begin(), sourceEnd = source.end();
+            auto targetIter = target.begin(), targetEnd = target.end();
+            while (sourceIter != sourceEnd && targetIter != targetEnd) {
+                if (less(*targetIter, *sourceIter)) {
+                    merged.push_back(std::move(*targetIter++));
+                } else {
+                    if (equal(*sourceIter, *targetIter)) {
+                        ++targetIter;
+                    }
+                    merged.push_back(std::move(*sourceIter++));
+                }
+            }
+            
+            merged.insert(merged.end(), std::make_move_iterator(sourceIter), std::make_move_iterator(sourceEnd));
+            merged.insert(merged.end(), std::make_move_iterator(targetIter), std::make_move_iterator(targetEnd));
+            target.swap(merged);
+            recordMerge(&LazyFlatSetStatistics::inplace_merges, target.size());
+        }
+    }
+    
+    // an empty set with the same tier sizes and allocators as this one
+    LazyFlatSet make_result() const {
+        return LazyFlatSet(maxUnsortedEntries_, maxNurseryEntries_, coll_.get_allocator(), nursery_.get_allocator(), unsorted_.get_allocator());
+    }
+    
+    template <class InputIt>
+    void set_union(InputIt first, InputIt last, base_collection& result, std::false_type) const {
+        std::set_union(coll_.cbegin(), coll_.cend(), first, last, std::back_inserter(result), compare_less());
+    }
+    
+    // runs of the larger range between values of the smaller one are copied in one go
+    void set_union(const value_type* first, const value_type* last, base_collection& result, std::true_type) const {
+        auto less = compare_less();
+        const value_type* a = coll_.data();
+        const value_type* aEnd = a + coll_.size();
+        result.reserve(coll_.size() + (last - first));
+        
+        if (LazyFlatSetGallop::asymmetric(last - first, aEnd - a)) {
+            for (; first != last; ++first) {
+                auto run = LazyFlatSetGallop::lower_bound(a, aEnd, *first, less);
+                result.insert(result.end(), a, run);
+                a = run;
+                if (a == aEnd || less(*first, *a)) {
+                    result.push_back(*first);
+                }
+            }
+            result.insert(result.end(), a, aEnd);
+        } else if (LazyFlatSetGallop::asymmetric(aEnd - a, last - first)) {
+            for (; a != aEnd; ++a) {
+                auto run = LazyFlatSetGallop::lower_bound(first, last, *a, less);
+                result.insert(result.end(), first, run);
+                first = run != last && !less(*a, *run) ? run + 1 : run;
+                result.push_back(*a);
+            }
+            result.insert(result.end(), first, last);
+        } else {
+            set_union(first, last, result, std::false_type());
+        }
+    }
+    
+    template <class InputIt>
+    void set_intersection(InputIt first, InputIt last, base_collection& result, std::false_type) const {
+        std::set_intersection(coll_.cbegin(), coll_.cend(), first, last, std::back_inserter(result), compare_less());
+    }
+    
+    void set_intersection(const value_type* first, const value_type* last, base_collection& result, std::true_type) const {
+        result.reserve(std::min<size_type>(coll_.size(), last - first));
+        LazyFlatSetIntersection<Value, compare_less_type>::intersect(coll_.data(), coll_.size(), first, last - first, std::back_inserter(result), compare_less());
+    }
+    
+    template <class InputIt>
+    void set_difference(InputIt first, InputIt last, base_collection& result, std::false_type) const {
+        std::set_difference(coll_.cbegin(), coll_.cend(), first, last, std::back_inserter(result), compare_less());
+    }
+    
+    void set_difference(const value_type* first, const value_type* last, base_collection& result, std::true_type) const {
+        auto less = compare_less();
+        const value_type* a = coll_.data();
+        const value_type* aEnd = a + coll_.size();
+        
+        if (LazyFlatSetGallop::asymmetric(last - first, aEnd - a)) {
+            result.reserve(coll_.size());
+            for (; first != last && a != aEnd; ++first) {
+                auto run = LazyFlatSetGallop::lower_bound(a, aEnd, *first, less);
+                result.insert(result.end(), a, run);
+                a = run != aEnd && !less(*first, *run) ? run + 1 : run;
+            }
+            result.insert(result.end(), a, aEnd);
+        } else if (LazyFlatSetGallop::asymmetric(aEnd - a, last - first)) {
+            for (; a != aEnd; ++a) {
+                first = LazyFlatSetGallop::lower_bound(first, last, *a, less);
+                if (first == last || less(*a, *first)) {
+                    result.push_back(*a);
+                }
+            }
+        } else {
+            set_difference(first, last, result, std::false_type());
+        }
+    }
+    
+    template <class InputIt>
+    bool includes(InputIt first, InputIt last, std::false_type) const {
+        return std::includes(coll_.cbegin(), coll_.cend(), first, last, compare_less());
+    }
+    
+    bool includes(const value_type* first, const value_type* last, std::true_type) const {
+        if (!LazyFlatSetGallop::asymmetric(last - first, coll_.size())) {
+            return includes(first, last, std::false_type());
+        }
+        
+        auto less = compare_less();
+        const value_type* a = coll_.data();
+        const value_type* aEnd = a + coll_.size();
+        for (; first != last; ++first) {
+            a = LazyFlatSetGallop::lower_bound(a, aEnd, *first, less);
+            if (a == aEnd || less(*first, *a)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // merges the sorted source into target, the source values are moved from
+    void merge(base_collection& source, base_collection& target) const {
+        if (source.size() > 0) {
+            auto less = compare_less();
+            if (target.size() == 0 || less(target.back(), source.front())) {
+                target.insert(target.end(), std::make_move_iterator(source.begin()), std::make_move_iterator(source.end()));
+                recordMerge(&LazyFlatSetStatistics::append_merges, source.size());
+            } else if (less(source.back(), target.front())) {
+                target.insert(target.begin(), std::make_move_iterator(source.begin()), std::make_move_iterator(source.end()));
+                recordMerge(&LazyFlatSetStatistics::prepend_merges, target.size());
+            } else {
+                // grow the target once then fill it from the back, runs of target values are found by
+                // galloping back from the end of the unmerged values and each is moved in one go
+                const auto targetSize = target.size();
+                grow(target, source, source.size(), std::is_default_constructible<value_type>());
+                
+                const auto gallop = LazyFlatSetGallop::asymmetric(source.size(), targetSize);
+                if (useParallel(target.size())) {
+                    const auto first = std::upper_bound(target.begin(), target.begin() + targetSize, source.front(), Less{});
+                    mergeParallel(source, target, targetSize, gallop);
+                    recordMerge(&LazyFlatSetStatistics::inplace_merges, (targetSize - (first - target.begin())) + source.size());
+                } else {
+                    auto out = target.end();
+                    auto last = target.begin() + targetSize;
+                    for (auto sourceIter = source.end(); sourceIter != source.begin(); ) {
+                        --sourceIter;
+                        last = moveGreater(target.begin(), last, *sourceIter, out, gallop, less);
+                        *--out = std::move(*sourceIter);
+                    }
+                    
+                    recordMerge(&LazyFlatSetStatistics::inplace_merges, (targetSize - (last - target.begin())) + source.size());
+                }
+            }
+        }
+    }
+    
+    // moves the values of the sorted range [first, last) greater than k to end at out, returns the end
+    // of the values left behind
+    template <class Compare>
+    iterator moveGreater(iterator first, iterator last, const value_type& k, iterator& out, bool gallop, const Compare& less) const {
+        if (gallop) {
+            auto greater = gallop_upper_bound(first, last, k, less);
+            out = std::move_backward(greater, last, out);
+            return greater;
+        }
+        
+        while (last != first && less(k, *(last - 1))) {
+            *--out = std::move(*--last);
+        }
+        return last;
+    }
+    
+    // the merge of source into the grown target split into a piece per thread, each piece takes its run of
+    // source values and its run of target values and is filled from the back like the single threaded merge.
+    // A piece's output starts past its target run by the number of source values in the pieces before it,
+    // so the head of each target run that the piece before could overwrite is first moved to scratch space
+    void mergeParallel(base_collection& source, base_collection& target, size_type targetSize, bool gallop) const {
+        const size_type pieces = pool_->concurrency();
+        std::vector<size_type> targetSplits, sourceSplits;
+        for (size_type i = 0; i <= pieces; ++i) {
+            const auto k = target.size() * i / pieces;
+            targetSplits.push_back(LazyFlatSetMergePath::split(target.begin(), targetSize, source.begin(), source.size(), k, Less{}));
+            sourceSplits.push_back(k - targetSplits.back());
+        }
+        
+        // the scratch space is allocated here since the tier's allocator may not be thread safe
+        std::vector<base_collection> heads(pieces, base_collection(target.get_allocator()));
+        std::vector<size_type> headSizes;
+        for (size_type i = 0; i < pieces; ++i) {
+            headSizes.push_back(std::min(sourceSplits[i], targetSplits[i + 1] - targetSplits[i]));
+            heads[i].reserve(headSizes.back());
+        }
+        
+        pool_->run(pieces, [&](std::size_t i) {
+            auto first = target.begin() + targetSplits[i];
+            heads[i].insert(heads[i].end(), std::make_move_iterator(first), std::make_move_iterator(first + headSizes[i]));
+        });
+        
+        pool_->run(pieces, [&](std::size_t i) {
+            Less less;
+            auto out = target.begin() + targetSplits[i + 1] + sourceSplits[i + 1];
+            auto first = target.begin() + targetSplits[i] + heads[i].size();
+            auto last = target.begin() + targetSplits[i + 1];
+            auto headLast = heads[i].end();
+            for (auto sourceIter = source.begin() + sourceSplits[i + 1]; sourceIter != source.begin() + sourceSplits[i]; ) {
+                --sourceIter;
+                last = moveGreater(first, last, *sourceIter, out, gallop, less);
+                if (last == first) {
+                    headLast = moveGreater(heads[i].begin(), headLast, *sourceIter, out, gallop, less);
+                }
+                *--out = std::move(*sourceIter);
+            }
+            
+            if (out != last) {
+                out = std::move_backward(first, last, out);
+            }
+            std::move_backward(heads[i].begin(), headLast, out);
+        });
+    }
+    
+    // adds space for count of the source values to the end of target, the values there are overwritten by the merge
+    void grow(base_collection& target, const base_collection&, size_type count, std::true_type) const {
+        target.resize(target.size() + count);
+    }
+    
+    void grow(base_collection& target, const base_collection& source, size_type count, std::false_type) const {
+        target.insert(target.end(), source.cbegin(), source.cbegin() + count);
+    }
+    
+    // the first value in the sorted range greater than k, searching back from last in doubling steps
+    template <class Compare>
+    iterator gallop_upper_bound(iterator first, iterator last, const value_type& k, const Compare& less) const {
+        size_type step = 1;
+        while (last != first) {
+            auto probe = static_cast<size_type>(last - first) > step ? last - step : first;
+            if (!less(k, *probe)) {
+                return std::upper_bound(probe + 1, last, k, less);
+            }
+            last = probe;
+            step *= 2;
+        }
+        return first;
+    }
+    
+    value_type getValue(base_collection& coll, int index, std::true_type) const {
+        return coll[index];
+    }    
+    
+    value_type_ptr getValue(base_collection& coll, int index, std::false_type) const {
+        return &coll[index];
+    }    
+    
+    mutable unsigned maxUnsortedEntries_;
+    mutable unsigned maxNurseryEntries_;
+    const unsigned minUnsortedEntries_;
+    const unsigned minNurseryEntries_;
+    bool searchIndexEnabled_;
+    bool deferredErase_;
+    bool adaptive_;
+    unsigned levelGrowth_;
+    LazyFlatSetThreadPool* pool_;
+    size_type parallelThreshold_;
+    
+    mutable base_collection coll_;
+    mutable std::vector<base_collection> levels_;
+    mutable base_collection nursery_;
+    mutable base_collection unsorted_;
+    
+    mutable base_collection searchIndex_;
+    mutable std::vector<size_type> searchIndexRanks_;
+    
+    mutable std::vector<size_type> erased_;
+    
+    mutable bool unsortedHinted_;
+    mutable size_type duplicatesRemoved_;
+    
+    mutable size_type adaptiveInserts_;
+    mutable size_type adaptiveLookups_;
+    mutable std::uint64_t mergeMoved_;
+    mutable double mergeShare_;
+    
+    mutable size_type unsortedMin_;
+    mutable size_type unsortedMax_;
+    mutable Filter nurseryFilter_;
+    mutable Filter unsortedFilter_;
+    mutable Stats stats_;
+};
+
+template <class Value, class Less>
+struct LazyFlatSetQuickSort {
+    template <class RandomIt>
+    void operator()(RandomIt first, RandomIt last) {
+        std::sort(first, last, Less{});
+    }
+};
+
+/**
+ * A LazyFlatSet variant for one writer and many readers. The sorted nursery and main collections
+ * are immutable states published through an atomic pointer, so count(), find() and size() never
+ * take a lock or touch a reference count. A reader registers in the current epoch with a counter
+ * in one of a few padded slots; a state the writer replaces is retired and only freed once every
+ * reader registered in the epoch it was retired in has left, which the writer checks each time it
+ * publishes. Inserts are buffered privately by the writer and become visible to readers when the
+ * unsorted buffer fills or publish() is called. Flushes merge into new buffers rather than in
+ * place. Writes are O(n): erase() copies the tier holding the value and where the writer replaces
+ * a value held in the main collection that collection is copied too, the newer value wins.
+**/
+template <class Value, class Less = std::less<Value>, class Equal = std::equal_to<Value>, class Sort = LazyFlatSetQuickSort<Value, Less>, class Alloc = std::allocator<Value> >
+class ConcurrentLazyFlatSet {
+public:
+    using base_collection = typename std::vector<Value, Alloc>;
+    using size_type = typename base_collection::size_type;
+    using value_type = Value;
+    using less_type = Less;
+    using equal_type = Equal;
+    using sort_type = Sort;
+    using alloc_type = Alloc;
+    using collection_ptr = std::shared_ptr<const base_collection>;
+
+    ConcurrentLazyFlatSet(unsigned maxUnsortedEntries = 16, unsigned maxNurseryEntries = 1024) :
+            maxUnsortedEntries_(maxUnsortedEntries), maxNurseryEntries_(maxNurseryEntries),
+            epoch_(0), state_(new state()) {
+        unsorted_.reserve(maxUnsortedEntries);
+        for (auto& slot : slots_) {
+            slot.active[0] = 0;
+            slot.active[1] = 0;
+        }
+    }
+
+    ConcurrentLazyFlatSet(const ConcurrentLazyFlatSet&) = delete;
+    ConcurrentLazyFlatSet& operator=(const ConcurrentLazyFlatSet&) = delete;
+
+    ~ConcurrentLazyFlatSet() {
+        delete state_.load();
+        for (auto& retired : retired_) {
+            for (auto stale : retired) {
+                delete stale;
+            }
+        }
+    }
+
+    void insert(const value_type& k) {
+        std::lock_guard<std::mutex> lock(writerMutex_);
+
+        auto iter = unsorted_.begin() + LazyFlatSetUnsortedScan<Value, Equal>::find(unsorted_.data(), unsorted_.size(), k);
+        if (iter != unsorted_.end()) {
+            *iter = k;
+        } else {
+            if (unsorted_.size() == maxUnsortedEntries_) {
+                publishUnsorted();
+            }
+
+            unsorted_.push_back(k);
+        }
+    }
+
+    size_type erase(const value_type& k) {
+        std::lock_guard<std::mutex> lock(writerMutex_);
+
+        size_type count = 0;
+
+        auto iter = unsorted_.begin() + LazyFlatSetUnsortedScan<Value, Equal>::find(unsorted_.data(), unsorted_.size(), k);
+        if (iter != unsorted_.end()) {
+            unsorted_.erase(iter);
+            count = 1;
+        }
+
+        // only the writer replaces the state so it can be read without registering
+        auto current = state_.load();
+        std::unique_ptr<state> next(new state(*current));
+        // both tiers are searched, a value must never be left behind in one of them
+        const auto erasedColl = eraseCopy(current->coll, next->coll, k);
+        const auto erasedNursery = eraseCopy(current->nursery, next->nursery, k);
+        if (erasedColl || erasedNursery) {
+            publishState(next.release());
+            count = 1;
+        }
+
+        return count;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(writerMutex_);
+        unsorted_.clear();
+        publishState(new state());
+    }
+
+    // makes any inserts buffered by the writer visible to readers
+    void publish() {
+        std::lock_guard<std::mutex> lock(writerMutex_);
+        publishUnsorted();
+    }
+
+    // publishes buffered inserts and merges the nursery into the main collection
+    void flush() {
+        std::lock_guard<std::mutex> lock(writerMutex_);
+        publishUnsorted();
+
+        auto current = state_.load();
+        if (current->nursery->size() > 0) {
+            std::unique_ptr<state> next(new state());
+            next->coll = merge(*current->nursery, *current->coll);
+            publishState(next.release());
+        }
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // the number of published values
+    size_type size() const {
+        reader guard(*this);
+        auto current = state_.load();
+        return current->coll->size() + current->nursery->size();
+    }
+
+    size_type count(const value_type& k) const {
+        reader guard(*this);
+        auto current = state_.load();
+        return search(*current->coll, k) != nullptr || search(*current->nursery, k) != nullptr ? 1 : 0;
+    }
+
+    bool find(const value_type& k, value_type& v) const {
+        reader guard(*this);
+        auto current = state_.load();
+
+        auto value = search(*current->coll, k);
+        if (value == nullptr) {
+            value = search(*current->nursery, k);
+        }
+
+        if (value != nullptr) {
+            v = *value;
+        }
+
+        return value != nullptr;
+    }
+
+    // a flushed, sorted and immutable view of the published values
+    collection_ptr snapshot() {
+        flush();
+        reader guard(*this);
+        return state_.load()->coll;
+    }
+
+private:
+    struct state {
+        state() : coll(std::make_shared<base_collection>()), nursery(std::make_shared<base_collection>()) {}
+
+        collection_ptr coll;
+        collection_ptr nursery;
+    };
+
+    static const unsigned readerSlots = 16;
+
+    // readers registered in each of the last two epochs, padded so slots don't share a cache line
+    struct reader_slot {
+        std::atomic<std::size_t> active[2];
+        char padding[64];
+    };
+
+    // registers the calling thread as a reader of the current epoch for its lifetime; registering
+    // races with the writer moving to the next epoch so the epoch is checked again afterwards
+    class reader {
+    public:
+        explicit reader(const ConcurrentLazyFlatSet& set) : slot_(set.readerSlot()) {
+            for (;;) {
+                epoch_ = set.epoch_.load();
+                slot_.active[epoch_ & 1].fetch_add(1);
+                if (set.epoch_.load() == epoch_) {
+                    break;
+                }
+                slot_.active[epoch_ & 1].fetch_sub(1);
+            }
+        }
+
+        ~reader() {
+            slot_.active[epoch_ & 1].fetch_sub(1);
+        }
+
+    private:
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+
+        reader_slot& slot_;
+        std::uint64_t epoch_;
+    };
+
+    reader_slot& readerSlot() const {
+        static thread_local const std::size_t slot = std::hash<std::thread::id>()(std::this_thread::get_id()) % readerSlots;
+        return slots_[slot];
+    }
+
+    // replaces the published state and retires the old one in the current epoch. Once no reader is left
+    // in the previous epoch the writer moves to the next, the states retired in the previous epoch can
+    // then no longer be held by a reader and are freed
+    void publishState(const state* next) {
+        const auto epoch = epoch_.load();
+        retired_[epoch & 1].push_back(state_.exchange(next));
+
+        const auto previous = (epoch + 1) & 1;
+        std::size_t active = 0;
+        for (const auto& slot : slots_) {
+            active += slot.active[previous].load();
+        }
+
+        if (active == 0) {
+            epoch_.store(epoch + 1);
+            for (auto stale : retired_[previous]) {
+                delete stale;
+            }
+            retired_[previous].clear();
+        }
+    }
+
+    static const value_type* search(const base_collection& coll, const value_type& k) {
+        auto iter = std::lower_bound(coll.cbegin(), coll.cend(), k, Less{});
+        return iter != coll.cend() && Equal{}(*iter, k) ? &*iter : nullptr;
+    }
+
+    static bool eraseCopy(const collection_ptr& source, collection_ptr& target, const value_type& k) {
+        auto iter = std::lower_bound(source->cbegin(), source->cend(), k, Less{});
+        if (iter != source->cend() && Equal{}(*iter, k)) {
+            auto coll = std::make_shared<base_collection>();
+            coll->reserve(source->size() - 1);
+            coll->insert(coll->end(), source->cbegin(), iter);
+            coll->insert(coll->end(), iter + 1, source->cend());
+            target = coll;
+            return true;
+        }
+
+        return false;
+    }
+
+    // merges the sorted newer values with the older ones, on a match the newer value is kept
+    static collection_ptr merge(const base_collection& newer, const base_collection& older) {
+        auto coll = std::make_shared<base_collection>();
+        coll->reserve(newer.size() + older.size());
+        std::set_union(newer.cbegin(), newer.cend(), older.cbegin(), older.cend(), std::back_inserter(*coll), Less{});
+        return coll;
+    }
+
+    void publishUnsorted() {
+        if (unsorted_.size() > 0) {
+            Sort{}(unsorted_.begin(), unsorted_.end());
+
+            auto current = state_.load();
+            std::unique_ptr<state> next(new state(*current));
+
+            // values already in the main collection are replaced there, the rest are new
+            base_collection replaced;
+            auto fresh = std::make_shared<base_collection>();
+            for (const auto& k : unsorted_) {
+                if (search(*current->coll, k) != nullptr) {
+                    replaced.push_back(k);
+                } else {
+                    fresh->push_back(k);
+                }
+            }
+
+            if (replaced.size() > 0) {
+                next->coll = merge(replaced, *current->coll);
+            }
+
+            // the fresh values replace their matches in the nursery before it can spill into the main
+            // collection, so no value is ever held by both tiers
+            auto nursery = merge(*fresh, *current->nursery);
+            if (nursery->size() > maxNurseryEntries_) {
+                next->coll = merge(*nursery, *next->coll);
+                next->nursery = std::make_shared<base_collection>();
+            } else {
+                next->nursery = nursery;
+            }
+
+            unsorted_.clear();
+            publishState(next.release());
+        }
+    }
+
+    const unsigned maxUnsortedEntries_;
+    const unsigned maxNurseryEntries_;
+
+    std::mutex writerMutex_;
+    base_collection unsorted_;
+    std::vector<const state*> retired_[2];
+    mutable reader_slot slots_[readerSlots];
+    std::atomic<std::uint64_t> epoch_;
+    std::atomic<const state*> state_;
+};
+
+/**
+ * Splits the key space into independent LazyFlatSet shards, each guarded by its own mutex, so
+ * inserts from many threads only contend when their keys land in the same shard. The shard
+ * boundaries are recalculated from the data when one shard grows past twice its fair share.
+**/
+template <class Value, class Less = std::less<Value>, class Equal = std::equal_to<Value>, class Sort = LazyFlatSetQuickSort<Value, Less>, class Alloc = std::allocator<Value> >
+class ShardedLazyFlatSet {
+public:
+    using shard_type = LazyFlatSet<Value, Less, Equal, Sort, Alloc>;
+    using size_type = typename shard_type::size_type;
+    using value_type = typename shard_type::value_type;
+    using const_reference = typename shard_type::const_reference;
+    using less_type = Less;
+    using equal_type = Equal;
+    using sort_type = Sort;
+    using alloc_type = Alloc;
+    using visit_type = typename std::function<void(const_reference)>;
+
+    ShardedLazyFlatSet(unsigned shards = 16, unsigned maxUnsortedEntries = 16, unsigned maxNurseryEntries = 1024, size_type minRebalanceSize = 64 * 1024) :
+            minRebalanceSize_(minRebalanceSize), boundaries_(std::make_shared<boundary_collection>()) {
+        shards_.reserve(shards);
+        for (unsigned i = 0; i < std::max(shards, 1u); ++i) {
+            shards_.emplace_back(new shard(maxUnsortedEntries, maxNurseryEntries));
+        }
+    }
+
+    void insert(const value_type& k) {
+        auto rebalanceShard = false;
+
+        {
+            std::unique_lock<std::mutex> lock;
+            auto& s = lockShard(k, lock);
+            s.set.insert(k);
+            s.size = s.set.size();
+            rebalanceShard = s.size > minRebalanceSize_ && s.size > ((2 * size()) / shards_.size());
+        }
+
+        if (rebalanceShard) {
+            rebalance();
+        }
+    }
+
+    size_type erase(const value_type& k) {
+        std::unique_lock<std::mutex> lock;
+        auto& s = lockShard(k, lock);
+        auto count = s.set.erase(k);
+        s.size = s.set.size();
+        return count;
+    }
+
+    size_type count(const value_type& k) const {
+        std::unique_lock<std::mutex> lock;
+        return lockShard(k, lock).set.count(k);
+    }
+
+    bool find(const value_type& k, value_type& v) const {
+        std::unique_lock<std::mutex> lock;
+        return lockShard(k, lock).set.find(k, v);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_type size() const {
+        size_type size = 0;
+        for (const auto& s : shards_) {
+            size += s->size;
+        }
+        return size;
+    }
+
+    void clear() {
+        for (auto& s : shards_) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            s->set.clear();
+            s->size = 0;
+        }
+    }
+
+    size_type shards() const {
+        return shards_.size();
+    }
+
+    size_type shard_size(size_type n) const {
+        return shards_[n]->size;
+    }
+
+    // appends the values to coll in sorted order
+    void copy(std::vector<Value>& coll) const {
+        for (const auto& s : shards_) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            s->set.copy(coll);
+        }
+    }
+
+    // visits the values in sorted order, the shards are locked one at a time
+    void for_each(visit_type visit) const {
+        for (const auto& s : shards_) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            for (auto iter = s->set.cbegin(), end = s->set.cend(); iter != end; ++iter) {
+                visit(*iter);
+            }
+        }
+    }
+
+    // redistributes the values so each shard holds an equal slice of the key space
+    void rebalance() {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (auto& s : shards_) {
+            locks.emplace_back(s->mutex);
+        }
+
+        std::vector<Value> coll;
+        coll.reserve(size());
+        for (auto& s : shards_) {
+            s->set.copy(coll);
+            s->set.clear();
+        }
+
+        const auto shardCount = shards_.size();
+        auto boundaries = std::make_shared<boundary_collection>();
+        for (size_type i = 1; i < shardCount && coll.size() > 0; ++i) {
+            boundaries->push_back(coll[(i * coll.size()) / shardCount]);
+        }
+
+        auto iter = coll.cbegin();
+        for (size_type i = 0; i < shardCount; ++i) {
+            auto end = i < boundaries->size() ? std::lower_bound(iter, coll.cend(), (*boundaries)[i], Less{}) : coll.cend();
+            auto& s = *shards_[i];
+            s.set.insert(iter, end);
+            s.size = s.set.size();
+            iter = end;
+        }
+
+        std::atomic_store(&boundaries_, std::shared_ptr<const boundary_collection>(boundaries));
+    }
+
+private:
+    using boundary_collection = std::vector<Value>;
+
+    struct shard {
+        shard(unsigned maxUnsortedEntries, unsigned maxNurseryEntries) : set(maxUnsortedEntries, maxNurseryEntries), size(0) {}
+
+        std::mutex mutex;
+        shard_type set;
+        std::atomic<size_type> size;
+    };
+
+    // locks the shard owning k, retrying if a rebalance moved the boundaries while we waited
+    shard& lockShard(const value_type& k, std::unique_lock<std::mutex>& lock) const {
+        for (;;) {
+            auto boundaries = std::atomic_load(&boundaries_);
+            auto index = std::upper_bound(boundaries->cbegin(), boundaries->cend(), k, Less{}) - boundaries->cbegin();
+
+            auto& s = *shards_[index];
+            lock = std::unique_lock<std::mutex>(s.mutex);
+            if (std::atomic_load(&boundaries_) == boundaries) {
+                return s;
+            }
+
+            lock.unlock();
+        }
+    }
+
+    const size_type minRebalanceSize_;
+
+    std::vector<std::unique_ptr<shard>> shards_;
+    std::shared_ptr<const boundary_collection> boundaries_;
+};
+
+#if defined(RS_LAZY_FLAT_SET_MMAP)
+/**
+ * A set over a snapshot written by LazyFlatSet::save(). The snapshot is mapped read only and shared,
+ * so opening it costs no more than the header check and the pages are shared with every other
+ * process mapping the same file. Lookups search the mapped values in place. Inserts go to an
+ * in-memory LazyFlatSet overlay. Inserting or erasing a mapped value marks it erased; an insert then
+ * keeps the new value in the overlay. Iteration merges the mapped values with the overlay. Writing
+ * the merged values with save() gives a new snapshot that includes the overlay.
+**/
+template <class Value, class Less = std::less<Value>, class Equal = std::equal_to<Value>, class Sort = LazyFlatSetQuickSort<Value, Less>, class Alloc = std::allocator<Value> >
+class MappedLazyFlatSet {
+public:
+    using overlay_type = LazyFlatSet<Value, Less, Equal, Sort, Alloc>;
+    using size_type = typename overlay_type::size_type;
+    using value_type = Value;
+    using less_type = Less;
+    using equal_type = Equal;
+
+    static_assert(std::is_trivially_copyable<Value>::value && !std::is_pointer<Value>::value, "snapshots hold trivially copyable values");
+
+    // walks the mapped values, skipping any that have been erased, and the overlay values in order
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Value;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Value*;
+        using reference = const Value&;
+
+        const_iterator() : set_(nullptr), mapped_(0), overlay_(nullptr), overlayEnd_(nullptr) {}
+
+        reference operator*() const {
+            return *current();
+        }
+
+        pointer operator->() const {
+            return current();
+        }
+
+        const_iterator& operator++() {
+            if (current() == overlay_) {
+                ++overlay_;
+            } else {
+                ++mapped_;
+                skipErased();
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto iter = *this;
+            ++*this;
+            return iter;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return mapped_ == other.mapped_ && overlay_ == other.overlay_;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class MappedLazyFlatSet;
+
+        const_iterator(const MappedLazyFlatSet* set, size_type mapped, const Value* overlay, const Value* overlayEnd) :
+                set_(set), mapped_(mapped), overlay_(overlay), overlayEnd_(overlayEnd) {
+            skipErased();
+        }
+
+        pointer current() const {
+            return mapped_ == set_->size_ || (overlay_ != overlayEnd_ && Less{}(*overlay_, set_->data_[mapped_])) ? overlay_ : set_->data_ + mapped_;
+        }
+
+        void skipErased() {
+            while (mapped_ < set_->size_ && set_->erased(mapped_)) {
+                ++mapped_;
+            }
+        }
+
+        const MappedLazyFlatSet* set_;
+        size_type mapped_;
+        const Value* overlay_;
+        const Value* overlayEnd_;
+    };
+
+    MappedLazyFlatSet(unsigned maxUnsortedEntries = 16, unsigned maxNurseryEntries = 1024) :
+            overlay_(maxUnsortedEntries, maxNurseryEntries), mapping_(nullptr), mappingSize_(0), data_(nullptr), size_(0), erasedCount_(0) {
+    }
+
+    MappedLazyFlatSet(const MappedLazyFlatSet&) = delete;
+    MappedLazyFlatSet& operator=(const MappedLazyFlatSet&) = delete;
+
+    ~MappedLazyFlatSet() {
+        close();
+    }
+
+    // maps the snapshot at path in place of any open one and clears the overlay; false when the
+    // file can't be mapped or wasn't written by a set of this value type, leaving the set empty
+    bool open(const std::string& path) {
+        close();
+
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        auto mapping = ::fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(LazyFlatSetSnapshotHeader) ?
+            ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+
+        auto header = static_cast<const LazyFlatSetSnapshotHeader*>(mapping);
+        if (!header->valid<Value>(st.st_size)) {
+            ::munmap(mapping, st.st_size);
+            return false;
+        }
+
+        mapping_ = mapping;
+        mappingSize_ = st.st_size;
+        data_ = reinterpret_cast<const Value*>(header + 1);
+        size_ = header->count;
+        return true;
+    }
+
+    // unmaps the snapshot and clears the overlay
+    void close() {
+        if (mapping_ != nullptr) {
+            ::munmap(mapping_, mappingSize_);
+        }
+
+        mapping_ = nullptr;
+        mappingSize_ = 0;
+        data_ = nullptr;
+        size_ = 0;
+        erased_.clear();
+        erasedCount_ = 0;
+        overlay_.clear();
+    }
+
+    bool is_open() const {
+        return mapping_ != nullptr;
+    }
+
+    void insert(const value_type& k) {
+        auto index = search(k);
+        if (index != size_) {
+            eraseAt(index);
+        }
+
+        overlay_.insert(k);
+    }
+
+    size_type erase(const value_type& k) {
+        auto index = search(k);
+        if (index != size_) {
+            eraseAt(index);
+            return 1;
+        }
+
+        return overlay_.erase(k);
+    }
+
+    size_type count(const value_type& k) const {
+        return search(k) != size_ || overlay_.count(k) != 0 ? 1 : 0;
+    }
+
+    bool contains(const value_type& k) const {
+        return count(k) != 0;
+    }
+
+    bool find(const value_type& k, value_type& v) const {
+        auto index = search(k);
+        if (index != size_) {
+            v = data_[index];
+            return true;
+        }
+
+        return overlay_.find(k, v);
+    }
+
+    size_type size() const {
+        return (size_ - erasedCount_) + overlay_.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // the number of values mapped from the snapshot, including any since erased
+    size_type mapped_size() const {
+        return size_;
+    }
+
+    const overlay_type& overlay() const {
+        return overlay_;
+    }
+
+    // iterators are invalidated by inserts and erases
+    const_iterator begin() const {
+        auto overlay = overlay_.data();
+        return const_iterator(this, 0, overlay, overlay + overlay_.size());
+    }
+
+    const_iterator end() const {
+        auto overlay = overlay_.data();
+        return const_iterator(this, size_, overlay + overlay_.size(), overlay + overlay_.size());
+    }
+
+    const_iterator cbegin() const {
+        return begin();
+    }
+
+    const_iterator cend() const {
+        return end();
+    }
+
+    // writes the mapped and overlay values to a new snapshot, path may be the open snapshot
+    bool save(const std::string& path) const {
+        return LazyFlatSetSnapshotHeader::write<Value>(path, begin(), end(), size());
+    }
+
+private:
+    // the index of the live mapped value equal to k, or size_
+    size_type search(const value_type& k) const {
+        auto index = LazyFlatSetSortedSearch<Value, Less>::lower_bound(data_, size_, k);
+        return index != size_ && Equal{}(data_[index], k) && !erased(index) ? index : size_;
+    }
+
+    bool erased(size_type index) const {
+        return erasedCount_ > 0 && erased_[index];
+    }
+
+    void eraseAt(size_type index) {
+        if (erased_.empty()) {
+            erased_.resize(size_);
+        }
+
+        erased_[index] = true;
+        ++erasedCount_;
+    }
+
+    overlay_type overlay_;
+
+    void* mapping_;
+    std::size_t mappingSize_;
+    const Value* data_;
+    size_type size_;
+
+    std::vector<bool> erased_;
+    size_type erasedCount_;
+};
+#endif
+
+/**
+ * A map built on the same unsorted/nursery/main tier design as LazyFlatSet. Each tier holds
+ * its keys and mapped values in separate vectors so the binary searches only touch key bytes.
+ * Pointers returned by find(), try_emplace() etc. remain valid until the next insert or erase.
+**/
+template <class Key, class Mapped, class Less = std::less<Key>, class Equal = std::equal_to<Key>, class KeyAlloc = std::allocator<Key>, class MappedAlloc = std::allocator<Mapped> >
+class LazyFlatMap {
+public:
+    using key_collection = typename std::vector<Key, KeyAlloc>;
+    using mapped_collection = typename std::vector<Mapped, MappedAlloc>;
+    using size_type = typename key_collection::size_type;
+    using key_type = Key;
+    using mapped_type = Mapped;
+    using less_type = Less;
+    using equal_type = Equal;
+    using key_alloc_type = KeyAlloc;
+    using mapped_alloc_type = MappedAlloc;
+    using visit_type = typename std::function<void(const key_type&, mapped_type&)>;
+
+    LazyFlatMap(unsigned maxUnsortedEntries = 16, unsigned maxNurseryEntries = 1024) :
+            maxUnsortedEntries_(maxUnsortedEntries), maxNurseryEntries_(maxNurseryEntries) {
+        unsorted_.keys.reserve(maxUnsortedEntries);
+        unsorted_.values.reserve(maxUnsortedEntries);
+    }
+
+    mapped_type& operator[](const key_type& k) {
+        return *try_emplace(k).first;
+    }
+
+    template <typename... Args>
+    std::pair<mapped_type*, bool> try_emplace(const key_type& k, Args&&... args) {
+        auto value = find(k);
+        if (value != nullptr) {
+            return std::make_pair(value, false);
+        }
+
+        if (unsorted_.size() == maxUnsortedEntries_) {
+            flushUnsorted();
+        }
+
+        unsorted_.keys.push_back(k);
+        unsorted_.values.emplace_back(std::forward<Args>(args)...);
+        return std::make_pair(&unsorted_.values.back(), true);
     }
-        
-    value_type_ptr find_fn(compare_type compare) const {
-        value_type_ptr value = nullptr;
-        
-        auto index = search(coll_, compare);
-        if (index != search_end) {
-            value = getValue(coll_, index, is_pointer<value_type>());
-        } else {
-            index = search(nursery_, compare);
-            if (index != search_end) {
-                value = getValue(nursery_, index, is_pointer<value_type>());
-            } else {
-                index = search_unsorted(unsorted_, compare);
-                if (index != search_end) {
-                    value = getValue(unsorted_, index, is_pointer<value_type>());
-                }
-            }
+
+    template <class M>
+    std::pair<mapped_type*, bool> insert_or_assign(const key_type& k, M&& obj) {
+        auto value = find(k);
+        if (value != nullptr) {
+            *value = std::forward<M>(obj);
+            return std::make_pair(value, false);
         }
-        
-        return value;
+
+        return try_emplace(k, std::forward<M>(obj));
     }
-        
-    const_reference operator[](size_type n) const {
-        flush();
-        return coll_[n];
+
+    bool empty() const {
+        return coll_.keys.empty() && nursery_.keys.empty() && unsorted_.keys.empty();
     }
-    
-    const_iterator cbegin() const {
-        flush();
-        return coll_.cbegin();
+
+    void clear() {
+        coll_.clear();
+        nursery_.clear();
+        unsorted_.clear();
     }
-    
-    const_iterator cend() const {
-        flush();
-        return coll_.cend();
-    }    
-    
-    const value_type* data() const {
+
+    void reserve(size_type n) {
+        coll_.keys.reserve(n);
+        coll_.values.reserve(n);
+    }
+
+    size_type size() const {
+        return coll_.size() + nursery_.size() + unsorted_.size();
+    }
+
+    void shrink_to_fit() {
         flush();
-        return coll_.data();
+        nursery_.shrink_to_fit();
+        coll_.shrink_to_fit();
     }
-    
-    size_type erase(const value_type& k) {
-        size_type count = 0;
-        
-        auto iter = lower_bound_equals(coll_, k);
-        if (iter != coll_.end()) {
-            coll_.erase(iter);
-            count = 1;
-        } else {
-            iter = lower_bound_equals(nursery_, k);
-            if (iter != nursery_.end()) {
-                nursery_.erase(iter);
-                count = 1;
-            } else {
-                iter = search_unsorted(unsorted_, k);
-                if (iter != unsorted_.end()) {
-                    unsorted_.erase(iter);
-                    count = 1;
-                }
-            }
-        }
-        
-        return count;
+
+    size_type count(const key_type& k) const {
+        return find(k) != nullptr ? 1 : 0;
     }
-    
-    size_type erase_fn(compare_type compare, erase_type erase = nullptr) {
-        size_type count = 0;
-        
-        auto index = search(coll_, compare);
+
+    mapped_type* find(const key_type& k) {
+        auto index = lower_bound_equals(coll_, k);
         if (index != search_end) {
-            if (erase != nullptr) {
-                erase(coll_[index]);
-            }
-            coll_.erase(coll_.begin() + index);
-            count = 1;
-        } else {
-            index = search(nursery_, compare);
-            if (index != search_end) {
-                if (erase != nullptr) {
-                    erase(nursery_[index]);
-                }
-                nursery_.erase(nursery_.begin() + index);
-                count = 1;
-            } else {
-                index = search_unsorted(unsorted_, compare);
-                if (index != search_end) {
-                    if (erase != nullptr) {
-                        erase(unsorted_[index]);
-                    }
-                    unsorted_.erase(unsorted_.begin() + index);
-                    count = 1;
-                }
-            }
+            return &coll_.values[index];
         }
-        
-        return count;
-    }
-    
-    void copy(std::vector<Value>& coll, bool sort = true) const {
-        if (sort) {
-            flush();
+
+        index = lower_bound_equals(nursery_, k);
+        if (index != search_end) {
+            return &nursery_.values[index];
         }
-        
-        const auto newSize = coll.size() + coll_.size() + nursery_.size() + unsorted_.size();
-        coll.reserve(newSize);
-        
-        coll.insert(coll.end(), coll_.cbegin(), coll_.cend());
-        coll.insert(coll.end(), nursery_.cbegin(), nursery_.cend());
-        coll.insert(coll.end(), unsorted_.cbegin(), unsorted_.cend());        
-    }
-    
-private:
-    const size_type search_end = -1;
-    
-    void sort(base_collection& coll) const {
-        Sort{}(coll.begin(), coll.end());
+
+        index = search_unsorted(unsorted_, k);
+        if (index != search_end) {
+            return &unsorted_.values[index];
+        }
+
+        return nullptr;
     }
 
-    iterator lower_bound(base_collection& coll, const value_type& k) const {
-        return std::lower_bound(coll.begin(), coll.end(), k, Less{});
+    const mapped_type* find(const key_type& k) const {
+        return const_cast<LazyFlatMap*>(this)->find(k);
     }
-    
-    iterator lower_bound_equals(base_collection& coll, const value_type& k) const {
-        auto iter = lower_bound(coll, k);
-        return iter != coll.end() && Equal{}(*iter, k) ? iter : coll.end();
+
+    size_type erase(const key_type& k) {
+        auto index = lower_bound_equals(coll_, k);
+        if (index != search_end) {
+            coll_.erase(index);
+            return 1;
+        }
+
+        index = lower_bound_equals(nursery_, k);
+        if (index != search_end) {
+            nursery_.erase(index);
+            return 1;
+        }
+
+        index = search_unsorted(unsorted_, k);
+        if (index != search_end) {
+            unsorted_.erase(index);
+            return 1;
+        }
+
+        return 0;
     }
-    
-    iterator upper_bound(base_collection& coll, const value_type& k) const {
-        return std::upper_bound(coll.begin(), coll.end(), k, Less{});
+
+    const key_type* keys() const {
+        flush();
+        return coll_.keys.data();
     }
-    
-    iterator upper_bound_equals(base_collection& coll, const value_type& k) const {
-        auto iter = upper_bound(coll, k);
-        return iter != coll.end() && Equal{}(*iter, k) ? iter : coll.end();
+
+    mapped_type* values() {
+        flush();
+        return coll_.values.data();
     }
-    
-    size_type search(base_collection& coll, compare_type compare) const {
-        const auto size = coll.size();
-        
-        if (size > 0) {
-            size_type min = 0;
-            size_type max = size - 1;
-            const auto data = coll.data();
 
-            while (max != search_end && max >= min) {
-                auto mid = ((max - min) / 2) + min;
+    const mapped_type* values() const {
+        flush();
+        return coll_.values.data();
+    }
 
-                const auto& item = data[mid];
-                auto diff = compare(item);
-                if (diff == 0) {
-                    return mid;
-                } else if (diff < 0) {
-                    max = mid - 1;
-                } else {
-                    min = mid + 1;
-                }
-            }
+    void for_each(visit_type visit) {
+        flush();
+        for (size_type i = 0, size = coll_.size(); i < size; ++i) {
+            visit(coll_.keys[i], coll_.values[i]);
         }
-        
-        return search_end;
     }
-    
-    size_type search_unsorted(base_collection& coll, compare_type compare) const {
-        const auto data = coll.data();
-        
-        for (size_type i = 0, size = coll.size(); i < size; ++i) {
-            if (compare(data[i]) == 0) {
-                return i;
-            }
+
+private:
+    struct tier {
+        size_type size() const {
+            return keys.size();
         }
-        
-        return search_end;
+
+        void clear() {
+            keys.clear();
+            values.clear();
+        }
+
+        void erase(size_type index) {
+            keys.erase(keys.begin() + index);
+            values.erase(values.begin() + index);
+        }
+
+        void shrink_to_fit() {
+            keys.shrink_to_fit();
+            values.shrink_to_fit();
+        }
+
+        key_collection keys;
+        mapped_collection values;
+    };
+
+    const size_type search_end = -1;
+
+    size_type lower_bound_equals(tier& t, const key_type& k) const {
+        auto index = LazyFlatSetSortedSearch<Key, Less>::lower_bound(t.keys.data(), t.keys.size(), k);
+        return index != t.size() && Equal{}(t.keys[index], k) ? index : search_end;
     }
-    
-    iterator search_unsorted(base_collection& coll, const value_type& k) const {
-        return std::search_n(coll.begin(), coll.end(), 1, k, Equal{});
+
+    size_type search_unsorted(tier& t, const key_type& k) const {
+        auto index = LazyFlatSetUnsortedScan<Key, Equal>::find(t.keys.data(), t.keys.size(), k);
+        return index != t.size() ? index : search_end;
     }
-    
+
     void flush() const {
         flushUnsorted();
         flushNursery();
@@ -431,7 +4395,7 @@ private:
             unsorted_.clear();
         }
     }
-    
+
     void flushNursery() const {
         if (nursery_.size() > 0) {
             merge(nursery_, coll_);
@@ -439,41 +4403,74 @@ private:
         }
     }
 
-    void merge(base_collection& source, base_collection& target) const {
+    void sort(tier& t) const {
+        const auto size = t.size();
+        std::vector<size_type> order(size);
+        for (size_type i = 0; i < size; ++i) {
+            order[i] = i;
+        }
+
+        Less less;
+        const auto& keys = t.keys;
+        std::sort(order.begin(), order.end(), [&](size_type x, size_type y) { return less(keys[x], keys[y]); });
+
+        tier sorted;
+        sorted.keys.reserve(size);
+        sorted.values.reserve(size);
+        for (auto i : order) {
+            sorted.keys.push_back(std::move(t.keys[i]));
+            sorted.values.push_back(std::move(t.values[i]));
+        }
+
+        std::swap(t.keys, sorted.keys);
+        std::swap(t.values, sorted.values);
+    }
+
+    void merge(tier& source, tier& target) const {
         if (source.size() > 0) {
             Less less;
-            if (target.size() == 0 || less(target.back(), source.front())) {
-                target.insert(target.end(), source.cbegin(), source.cend());
-            } else if (less(source.back(), target.front())) {
-                target.insert(target.begin(), source.cbegin(), source.cend());
+            if (target.size() == 0 || less(target.keys.back(), source.keys.front())) {
+                append(source, 0, source.size(), target);
+            } else if (less(source.keys.back(), target.keys.front())) {
+                target.keys.insert(target.keys.begin(), std::make_move_iterator(source.keys.begin()), std::make_move_iterator(source.keys.end()));
+                target.values.insert(target.values.begin(), std::make_move_iterator(source.values.begin()), std::make_move_iterator(source.values.end()));
             } else {
-                target.insert(target.end(), source.cbegin(), source.cend());
-                std::inplace_merge(target.begin(), target.end() - source.size(), target.end(), less);
+                tier merged;
+                merged.keys.reserve(source.size() + target.size());
+                merged.values.reserve(source.size() + target.size());
+
+                size_type s = 0, t = 0;
+                const auto sourceSize = source.size(), targetSize = target.size();
+                while (s < sourceSize && t < targetSize) {
+                    if (less(source.keys[s], target.keys[t])) {
+                        append(source, s, s + 1, merged);
+                        ++s;
+                    } else {
+                        append(target, t, t + 1, merged);
+                        ++t;
+                    }
+                }
+
+                append(source, s, sourceSize, merged);
+                append(target, t, targetSize, merged);
+
+                std::swap(target.keys, merged.keys);
+                std::swap(target.values, merged.values);
             }
         }
     }
-    
-    value_type getValue(base_collection& coll, int index, std::true_type) const {
-        return coll[index];
-    }    
-    
-    value_type_ptr getValue(base_collection& coll, int index, std::false_type) const {
-        return &coll[index];
-    }    
-    
+
+    static void append(tier& source, size_type first, size_type last, tier& target) {
+        target.keys.insert(target.keys.end(), std::make_move_iterator(source.keys.begin() + first), std::make_move_iterator(source.keys.begin() + last));
+        target.values.insert(target.values.end(), std::make_move_iterator(source.values.begin() + first), std::make_move_iterator(source.values.begin() + last));
+    }
+
     const unsigned maxUnsortedEntries_;
     const unsigned maxNurseryEntries_;
-    
-    mutable base_collection coll_;
-    mutable base_collection nursery_;
-    mutable base_collection unsorted_;
-};
 
-template <class Value, class Less>
-struct LazyFlatSetQuickSort {
-    void operator()(typename LazyFlatSet<Value>::iterator first, typename LazyFlatSet<Value>::iterator last) {
-        std::sort(first, last, Less{});
-    }
+    mutable tier coll_;
+    mutable tier nursery_;
+    mutable tier unsorted_;
 };
 
 }
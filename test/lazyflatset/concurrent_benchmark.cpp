@@ -0,0 +1,85 @@
+#include <iostream>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#include "../../lazyflatset.hpp"
+
+using DataType = unsigned;
+
+// one writer inserts the data while the readers count random keys, returns the total reads per second
+template <class Insert, class Count>
+double test(const std::vector<DataType>& data, unsigned readerThreads, Insert insert, Count count) {
+    std::atomic<bool> done(false);
+    std::atomic<unsigned long> reads(0);
+    
+    std::vector<std::thread> readers;
+    for (unsigned r = 0; r < readerThreads; ++r) {
+        readers.emplace_back([&, r]() {
+            unsigned long localReads = 0;
+            unsigned k = r;
+            while (!done) {
+                k = k * 1103515245 + 12345;
+                count(data[k % data.size()]);
+                ++localReads;
+            }
+            reads += localReads;
+        });
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    for (auto k : data) {
+        insert(k);
+    }
+    auto duration = std::chrono::steady_clock::now() - start;
+    
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    
+    auto durationMS = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    return durationMS > 0 ? (reads * 1000.0) / durationMS : 0.0;
+}
+
+double lockedLazyFlatSet(const std::vector<DataType>& data, unsigned readerThreads) {
+    rs::LazyFlatSet<DataType> set(128, 32 * 1024);
+    std::mutex mutex;
+    
+    return test(data, readerThreads, 
+        [&](DataType k) { std::lock_guard<std::mutex> lock(mutex); set.insert(k); }, 
+        [&](DataType k) { std::lock_guard<std::mutex> lock(mutex); return set.count(k); });
+}
+
+double concurrentLazyFlatSet(const std::vector<DataType>& data, unsigned readerThreads) {
+    rs::ConcurrentLazyFlatSet<DataType> set(128, 32 * 1024);
+    
+    return test(data, readerThreads, 
+        [&](DataType k) { set.insert(k); }, 
+        [&](DataType k) { return set.count(k); });
+}
+
+int main() {
+    std::vector<DataType> data;
+    const unsigned max = 1000 * 1000;
+    for (unsigned i = 0; i < max; ++i) {
+        data.push_back(i);
+    }
+    
+    std::random_shuffle(data.begin(), data.end());
+    
+    std::cout << R"("readers", "lockedLazyFlatSet [reads/s]", "concurrentLazyFlatSet [reads/s]")" << std::endl;
+    
+    const auto hardwareThreads = std::max(2u, std::thread::hardware_concurrency());
+    for (unsigned readers = 1; readers < hardwareThreads; readers *= 2) {
+        std::cout << readers << ", ";
+        std::cout << static_cast<unsigned long>(lockedLazyFlatSet(data, readers)) << ", ";
+        std::cout << static_cast<unsigned long>(concurrentLazyFlatSet(data, readers)) << std::endl;
+    }
+    
+    return 0;
+}
@@ -1,173 +1,406 @@
 #include <iostream>
+#include <sstream>
+#include <iomanip>
 #include <chrono>
 #include <functional>
+#include <random>
+#include <string>
+#include <cstring>
+#include <cstdlib>
 
 #include <vector>
 #include <set>
-#include <unordered_set>
-#include <list>
-#include <queue>
+#include <memory>
+#include <algorithm>
 
 #include "../../lazyflatset.hpp"
 
-using DataType = unsigned;
-using SourceIterator = std::vector<DataType>::iterator;
+// usage: lazyflatset [--sizes n,n,...] [--runs n] [--warmup n] [--format csv|json] [--filter text]
+//
+// Every workload is run warmup + runs times, the ops in each timed run are timed in batches and
+// the median and 99th percentile batch cost are reported in nanoseconds per op along with the mean.
 
-using TestFunction = std::function<void(SourceIterator, SourceIterator)>;
+struct Options {
+    std::vector<std::size_t> sizes = { 1000, 100 * 1000, 1000 * 1000 };
+    unsigned runs = 5;
+    unsigned warmup = 1;
+    std::string format = "csv";
+    std::string filter;
+};
 
-void vectorHeadInsert(SourceIterator begin, SourceIterator end) {
-    std::vector<DataType> data;
-    data.insert(data.begin(), begin, end);
-}
+struct Record {
+    unsigned key;
+};
 
-void vectorTailInsert(SourceIterator begin, SourceIterator end) {
-    std::vector<DataType> data;
-    data.insert(data.end(), begin, end);
-}
+template <class T>
+struct DerefLess {
+    bool operator()(const T& a, const T& b) const {
+        return a->key < b->key;
+    }
+};
 
-void vectorHeadPush(SourceIterator begin, SourceIterator end) {
-    std::vector<DataType> data;
-    
-    for (auto iter = begin; iter != end; ++iter) {
-        data.insert(data.begin(), *iter);
+template <class T>
+struct DerefEqual {
+    bool operator()(const T& a, const T& b) const {
+        return a->key == b->key;
     }
-}
+};
+
+// makes the values held by a set, the set holds the even keys so the odd keys always miss
+template <class T>
+struct Values;
+
+template <>
+struct Values<unsigned> {
+    static constexpr const char* name = "unsigned";
+
+    unsigned make(unsigned key) {
+        return key;
+    }
+
+    static unsigned key(unsigned value) {
+        return value;
+    }
+};
 
-void vectorTailPush(SourceIterator begin, SourceIterator end) {
-    std::vector<DataType> data;
-    
-    for (auto iter = begin; iter != end; ++iter) {
-        data.push_back(*iter);
+template <>
+struct Values<std::string> {
+    static constexpr const char* name = "string";
+
+    std::string make(unsigned key) {
+        std::ostringstream stream;
+        stream << "key-" << std::setw(12) << std::setfill('0') << key;
+        return stream.str();
+    }
+
+    static unsigned key(const std::string& value) {
+        return value.back();
+    }
+};
+
+template <>
+struct Values<Record*> {
+    static constexpr const char* name = "pointer";
+
+    Record* make(unsigned key) {
+        records.emplace_back(new Record{ key });
+        return records.back().get();
+    }
+
+    static unsigned key(const Record* value) {
+        return value->key;
     }
+
+    std::vector<std::unique_ptr<Record>> records;
+};
+
+template <>
+struct Values<std::shared_ptr<Record>> {
+    static constexpr const char* name = "shared_ptr";
+
+    std::shared_ptr<Record> make(unsigned key) {
+        return std::make_shared<Record>(Record{ key });
+    }
+
+    static unsigned key(const std::shared_ptr<Record>& value) {
+        return value->key;
+    }
+};
+
+constexpr const char* Values<unsigned>::name;
+constexpr const char* Values<std::string>::name;
+constexpr const char* Values<Record*>::name;
+constexpr const char* Values<std::shared_ptr<Record>>::name;
+
+template <class T> struct SetTypes {
+    using Less = std::less<T>;
+    using Equal = std::equal_to<T>;
+};
+
+template <class T> struct SetTypes<T*> {
+    using Less = DerefLess<T*>;
+    using Equal = DerefEqual<T*>;
+};
+
+template <class T> struct SetTypes<std::shared_ptr<T>> {
+    using Less = DerefLess<std::shared_ptr<T>>;
+    using Equal = DerefEqual<std::shared_ptr<T>>;
+};
+
+template <class T>
+using LazyFlatSet = rs::LazyFlatSet<T, typename SetTypes<T>::Less, typename SetTypes<T>::Equal, rs::LazyFlatSetQuickSort<T, typename SetTypes<T>::Less>>;
+
+template <class T>
+using StdSet = std::set<T, typename SetTypes<T>::Less>;
+
+// the operations the workloads use, so each runs unchanged against LazyFlatSet and std::set
+template <class T>
+LazyFlatSet<T> makeSet(LazyFlatSet<T>*) {
+    return LazyFlatSet<T>(128, 32 * 1024);
 }
 
-void setInsert(SourceIterator begin, SourceIterator end) {
-    std::set<DataType> data;
-    data.insert(begin, end);
+template <class T>
+StdSet<T> makeSet(StdSet<T>*) {
+    return StdSet<T>();
 }
 
-void unorderedSetInsert(SourceIterator begin, SourceIterator end) {
-    std::unordered_set<DataType> data;
-    data.insert(begin, end);
+template <class T>
+void flush(LazyFlatSet<T>& set) {
+    set.data();
 }
 
-void priorityQueuePush(SourceIterator begin, SourceIterator end) {
-    std::priority_queue <DataType> data;
-    
-    for (auto iter = begin; iter != end; ++iter) {
-        data.push(*iter);
-    }
+template <class T>
+void flush(StdSet<T>&) {
 }
 
-void listTailInsert(SourceIterator begin, SourceIterator end) {
-    std::list<DataType> data;
-    data.insert(data.begin(), begin, end);
+template <class T> const char* setName(LazyFlatSet<T>*) { return "LazyFlatSet"; }
+template <class T> const char* setName(StdSet<T>*) { return "std::set"; }
+
+struct Result {
+    std::string set;
+    std::string type;
+    std::size_t size;
+    std::string workload;
+    std::size_t ops;
+    double mean;
+    double median;
+    double p99;
+};
+
+// times the ops of each run in batches, the batch costs of all the timed runs make up the percentiles
+class Timer {
+public:
+    static const std::size_t batchSize = 256;
+
+    Timer() : ops_(0), total_(0) {}
+
+    template <class Op>
+    void run(std::size_t ops, Op op) {
+        for (std::size_t first = 0; first < ops; first += batchSize) {
+            const auto last = std::min(ops, first + batchSize);
+
+            auto start = std::chrono::steady_clock::now();
+            for (auto i = first; i < last; ++i) {
+                op(i);
+            }
+            auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+            batches_.push_back(static_cast<double>(duration) / (last - first));
+            total_ += duration;
+        }
+
+        ops_ += ops;
+    }
+
+    Result result() {
+        Result result;
+        std::sort(batches_.begin(), batches_.end());
+        result.ops = ops_;
+        result.mean = ops_ > 0 ? static_cast<double>(total_) / ops_ : 0;
+        result.median = percentile(0.5);
+        result.p99 = percentile(0.99);
+        return result;
+    }
+
+private:
+    double percentile(double rank) const {
+        return batches_.empty() ? 0 : batches_[static_cast<std::size_t>(rank * (batches_.size() - 1))];
+    }
+
+    std::size_t ops_;
+    long long total_;
+    std::vector<double> batches_;
+};
+
+template <class Set, class T>
+class Benchmark {
+public:
+    Benchmark(const Options& options, std::size_t size, std::vector<Result>& results) :
+            options_(options), size_(size), results_(results) {
+        // seeded with the size so both sets see the same order
+        std::mt19937 random(size);
+
+        for (unsigned i = 0; i < size; ++i) {
+            hits_.push_back(values_.make(i * 2));
+            misses_.push_back(values_.make((i * 2) + 1));
+        }
+
+        ascending_ = hits_;
+        std::shuffle(hits_.begin(), hits_.end(), random);
+        std::shuffle(misses_.begin(), misses_.end(), random);
+    }
+
+    void run() {
+        // inserts the shuffled values
+        measure("insert", [&](Timer& timer) {
+            auto set = makeSet(static_cast<Set*>(nullptr));
+            timer.run(size_, [&](std::size_t i) { set.insert(hits_[i]); });
+            timer.run(1, [&](std::size_t) { flush(set); });
+        });
+
+        // inserts the values in ascending order
+        measure("insert ascending", [&](Timer& timer) {
+            auto set = makeSet(static_cast<Set*>(nullptr));
+            timer.run(size_, [&](std::size_t i) { set.insert(ascending_[i]); });
+            timer.run(1, [&](std::size_t) { flush(set); });
+        });
+
+        auto full = filled(size_);
+
+        measure("lookup hit", [&](Timer& timer) {
+            timer.run(size_, [&](std::size_t i) { sink_ += full.count(hits_[i]); });
+        });
+
+        measure("lookup miss", [&](Timer& timer) {
+            timer.run(size_, [&](std::size_t i) { sink_ += full.count(misses_[i]); });
+        });
+
+        measure("iterate", [&](Timer& timer) {
+            auto iter = full.cbegin();
+            timer.run(size_, [&](std::size_t) { sink_ += Values<T>::key(*iter++); });
+        });
+
+        // erases half of the values, the set is refilled for each run outside of the timing
+        measure("erase", [&](Timer& timer) {
+            auto set = filled(size_);
+            timer.run(size_ / 2, [&](std::size_t i) { sink_ += set.erase(hits_[i]); });
+        });
+
+        // nine lookups, half of which miss, for each insert of a new value; the hits come from the half
+        // of the values the set starts with so there must be at least two values
+        if (size_ >= 2) {
+            measure("mixed", [&](Timer& timer) {
+                auto set = filled(size_ / 2);
+                auto inserted = size_ / 2;
+                timer.run(size_, [&](std::size_t i) {
+                    if (i % 10 == 0 && inserted < size_) {
+                        set.insert(hits_[inserted++]);
+                    } else {
+                        sink_ += set.count(i % 2 == 0 ? hits_[i % (size_ / 2)] : misses_[i]);
+                    }
+                });
+            });
+        }
+
+        if (sink_ == 1) {
+            std::cerr << sink_ << std::endl;
+        }
+    }
+
+private:
+    Set filled(std::size_t size) {
+        auto set = makeSet(static_cast<Set*>(nullptr));
+        for (std::size_t i = 0; i < size; ++i) {
+            set.insert(hits_[i]);
+        }
+        flush(set);
+        return set;
+    }
+
+    void measure(const char* workload, std::function<void(Timer&)> func) {
+        if (!options_.filter.empty() && std::string(workload).find(options_.filter) == std::string::npos) {
+            return;
+        }
+
+        for (unsigned i = 0; i < options_.warmup; ++i) {
+            Timer timer;
+            func(timer);
+        }
+
+        Timer timer;
+        for (unsigned i = 0; i < options_.runs; ++i) {
+            func(timer);
+        }
+
+        auto result = timer.result();
+        result.set = setName(static_cast<Set*>(nullptr));
+        result.type = Values<T>::name;
+        result.size = size_;
+        result.workload = workload;
+        results_.push_back(result);
+
+        std::cerr << result.set << " " << result.type << " " << size_ << " " << workload << std::endl;
+    }
+
+    const Options& options_;
+    const std::size_t size_;
+    std::vector<Result>& results_;
+
+    Values<T> values_;
+    std::vector<T> hits_;
+    std::vector<T> misses_;
+    std::vector<T> ascending_;
+    std::size_t sink_ = 0;
+};
+
+template <class T>
+void benchmark(const Options& options, std::vector<Result>& results) {
+    for (auto size : options.sizes) {
+        Benchmark<LazyFlatSet<T>, T>(options, size, results).run();
+        Benchmark<StdSet<T>, T>(options, size, results).run();
+    }
 }
 
-void lazyFlatSetInsert(SourceIterator begin, SourceIterator end) {
-    rs::LazyFlatSet<DataType> data(128, 32 * 1024);
-    
-    for (auto iter = begin; iter != end; ++iter) {
-        data.insert(*iter);
+void writeCsv(const std::vector<Result>& results) {
+    std::cout << R"("set", "type", "size", "workload", "ops", "mean [ns/op]", "median [ns/op]", "p99 [ns/op]")" << std::endl;
+    for (const auto& r : results) {
+        std::cout << '"' << r.set << "\", \"" << r.type << "\", " << r.size << ", \"" << r.workload << "\", " << r.ops << ", " <<
+            r.mean << ", " << r.median << ", " << r.p99 << std::endl;
     }
 }
 
-void lazyFlatSetInsertNewItem(SourceIterator begin, SourceIterator end) {
-    rs::LazyFlatSet<DataType> data(128, 32 * 1024);
-    
-    for (auto iter = begin; iter != end; ++iter) {
-        data.insert(*iter, rs::LazyFlatSet<DataType>::insert_hint::new_item);
+void writeJson(const std::vector<Result>& results) {
+    std::cout << "[" << std::endl;
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        std::cout << R"(  { "set": ")" << r.set << R"(", "type": ")" << r.type << R"(", "size": )" << r.size << R"(, "workload": ")" << r.workload <<
+            R"(", "ops": )" << r.ops << R"(, "mean": )" << r.mean << R"(, "median": )" << r.median << R"(, "p99": )" << r.p99 << " }" <<
+            (i + 1 < results.size() ? "," : "") << std::endl;
     }
+    std::cout << "]" << std::endl;
 }
 
-void test(TestFunction func, SourceIterator begin, SourceIterator end, bool eol = false) {
-    auto start = std::chrono::steady_clock::now();
-    func(begin, end);
-    auto duration = std::chrono::steady_clock::now() - start;
-    auto durationMS = std::chrono::duration_cast<std::chrono::milliseconds>(duration);
-    
-    std::cout << durationMS.count();
-    
-    if (eol) {
-        std::cout << std::endl;
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i += 2) {
+        const std::string option = argv[i];
+        if (option != "--sizes" && option != "--runs" && option != "--warmup" && option != "--format" && option != "--filter") {
+            std::cerr << "unknown option " << argv[i] << std::endl;
+            return 1;
+        } else if (i + 1 == argc) {
+            std::cerr << "missing value for option " << argv[i] << std::endl;
+            return 1;
+        }
+
+        if (std::strcmp(argv[i], "--sizes") == 0) {
+            options.sizes.clear();
+            std::istringstream sizes(argv[i + 1]);
+            std::string size;
+            while (std::getline(sizes, size, ',')) {
+                options.sizes.push_back(std::strtoul(size.c_str(), nullptr, 10));
+            }
+        } else if (std::strcmp(argv[i], "--runs") == 0) {
+            options.runs = std::max(1ul, std::strtoul(argv[i + 1], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--warmup") == 0) {
+            options.warmup = std::strtoul(argv[i + 1], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--format") == 0) {
+            options.format = argv[i + 1];
+        } else {
+            options.filter = argv[i + 1];
+        }
+    }
+
+    std::vector<Result> results;
+    benchmark<unsigned>(options, results);
+    benchmark<std::string>(options, results);
+    benchmark<Record*>(options, results);
+    benchmark<std::shared_ptr<Record>>(options, results);
+
+    if (options.format == "json") {
+        writeJson(results);
     } else {
-        std::cout << ", ";
+        writeCsv(results);
     }
-}
 
-int main() {
-    std::vector<DataType> data;
-    const unsigned max = 5 * 1000 * 1000;
-    for (unsigned i = 0; i < max; ++i) {
-        data.push_back(i);
-    }
-    
-    std::cout << R"("", "listTailInsert", "vectorTailInsert", "vectorTailPush", "vectorHeadInsert", "setInsert", "unorderedSetInsert", "priorityQueuePush", "lazyFlatSetInsert", "lazyFlatSetInsert[new_item]")" << std::endl;
-    
-    std::cout << R"("Ascending", )";
-    
-    test(listTailInsert, data.begin(), data.end());
-    test(vectorTailInsert, data.begin(), data.end());
-    test(vectorTailPush, data.begin(), data.end());
-    test(vectorHeadInsert, data.begin(), data.end());
-    //test(vectorHeadPush, data.begin(), data.end());
-    test(setInsert, data.begin(), data.end());
-    test(unorderedSetInsert, data.begin(), data.end());
-    test(priorityQueuePush, data.begin(), data.end());
-    test(lazyFlatSetInsert, data.begin(), data.end());
-    test(lazyFlatSetInsertNewItem, data.begin(), data.end(), true);
-    
-    std::cout << R"("Descending", )";
-    
-    std::reverse(data.begin(), data.end());
-    
-    test(listTailInsert, data.begin(), data.end());
-    test(vectorTailInsert, data.begin(), data.end());
-    test(vectorTailPush, data.begin(), data.end());
-    test(vectorHeadInsert, data.begin(), data.end());
-    //test(vectorHeadPush, data.begin(), data.end());
-    test(setInsert, data.begin(), data.end());
-    test(unorderedSetInsert, data.begin(), data.end());
-    test(priorityQueuePush, data.begin(), data.end());
-    test(lazyFlatSetInsert, data.begin(), data.end());
-    test(lazyFlatSetInsertNewItem, data.begin(), data.end(), true);
-    
-    std::cout << R"("Partial shuffle", )";
-    
-    const unsigned blocks = 10000;
-    const unsigned blockSize = max / blocks;
-    auto iter = data.begin();
-    for (unsigned i = 0; i < blocks; ++i) {
-        auto iterEnd = iter + blockSize;
-        std::random_shuffle(iter, iterEnd < data.end() ? iterEnd : data.end());
-        iter += blockSize;
-    }        
-    
-    test(listTailInsert, data.begin(), data.end());
-    test(vectorTailInsert, data.begin(), data.end());
-    test(vectorTailPush, data.begin(), data.end());
-    test(vectorHeadInsert, data.begin(), data.end());
-    //test(vectorHeadPush, data.begin(), data.end());
-    test(setInsert, data.begin(), data.end());
-    test(unorderedSetInsert, data.begin(), data.end());
-    test(priorityQueuePush, data.begin(), data.end());
-    test(lazyFlatSetInsert, data.begin(), data.end());
-    test(lazyFlatSetInsertNewItem, data.begin(), data.end(), true);
-    
-    std::cout << R"("Full shuffle", )";
-    
-    std::random_shuffle(data.begin(), data.end());
-
-    test(listTailInsert, data.begin(), data.end());
-    test(vectorTailInsert, data.begin(), data.end());
-    test(vectorTailPush, data.begin(), data.end());
-    test(vectorHeadInsert, data.begin(), data.end());
-    //test(vectorHeadPush, data.begin(), data.end());
-    test(setInsert, data.begin(), data.end());
-    test(unorderedSetInsert, data.begin(), data.end());
-    test(priorityQueuePush, data.begin(), data.end());
-    test(lazyFlatSetInsert, data.begin(), data.end());
-    test(lazyFlatSetInsertNewItem, data.begin(), data.end(), true);
-    
     return 0;
-}
\ No newline at end of file
+}
@@ -44,14 +44,15 @@ TESTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}/tests
 TESTFILES= \
 	${TESTDIR}/TestFiles/f1 \
 	${TESTDIR}/TestFiles/f3 \
-	${TESTDIR}/TestFiles/f2
+	${TESTDIR}/TestFiles/f2 \
+	${TESTDIR}/TestFiles/f4
 
 # C Compiler Flags
 CFLAGS=
 
 # CC Compiler Flags
-CCFLAGS=$(COVERAGE_FLAGS)
-CXXFLAGS=$(COVERAGE_FLAGS)
+CCFLAGS=$(COVERAGE_FLAGS) -pthread
+CXXFLAGS=$(COVERAGE_FLAGS) -pthread
 
 # Fortran Compiler Flags
 FFLAGS=
@@ -92,6 +93,10 @@ ${TESTDIR}/TestFiles/f2: ${TESTDIR}/tests/test_timsort.o ${TESTDIR}/tests/test_t
 	${MKDIR} -p ${TESTDIR}/TestFiles
 	${LINK.cc}   -o ${TESTDIR}/TestFiles/f2 $^ ${LDLIBSOPTIONS} `cppunit-config --libs`   
 
+${TESTDIR}/TestFiles/f4: ${TESTDIR}/tests/map_operations.o ${TESTDIR}/tests/map_operations_runner.o ${OBJECTFILES:%.o=%_nomain.o}
+	${MKDIR} -p ${TESTDIR}/TestFiles
+	${LINK.cc}   -o ${TESTDIR}/TestFiles/f4 $^ ${LDLIBSOPTIONS} `cppunit-config --libs`   
+
 
 ${TESTDIR}/tests/basic_operations.o: tests/basic_operations.cpp 
 	${MKDIR} -p ${TESTDIR}/tests
@@ -129,6 +134,18 @@ ${TESTDIR}/tests/test_timsort_runner.o: tests/test_timsort_runner.cpp
 	$(COMPILE.cc) -g -std=c++11 --std=c++11 `cppunit-config --cflags` -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/test_timsort_runner.o tests/test_timsort_runner.cpp
 
 
+${TESTDIR}/tests/map_operations.o: tests/map_operations.cpp 
+	${MKDIR} -p ${TESTDIR}/tests
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -std=c++11 --std=c++11 `cppunit-config --cflags` -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/map_operations.o tests/map_operations.cpp
+
+
+${TESTDIR}/tests/map_operations_runner.o: tests/map_operations_runner.cpp 
+	${MKDIR} -p ${TESTDIR}/tests
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -std=c++11 --std=c++11 `cppunit-config --cflags` -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/map_operations_runner.o tests/map_operations_runner.cpp
+
+
 ${OBJECTDIR}/main_nomain.o: ${OBJECTDIR}/main.o main.cpp 
 	${MKDIR} -p ${OBJECTDIR}
 	@NMOUTPUT=`${NM} ${OBJECTDIR}/main.o`; \
@@ -149,6 +166,7 @@ ${OBJECTDIR}/main_nomain.o: ${OBJECTDIR}/main.o main.cpp
 	    ${TESTDIR}/TestFiles/f1 || true; \
 	    ${TESTDIR}/TestFiles/f3 || true; \
 	    ${TESTDIR}/TestFiles/f2 || true; \
+	    ${TESTDIR}/TestFiles/f4 || true; \
 	else  \
 	    ./${TEST} || true; \
 	fi
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#include "../../lazyflatset.hpp"
+
+using DataType = unsigned;
+using LazyFlatSet = rs::LazyFlatSet<DataType>;
+
+// times the lookup of every key in keys, returns nanoseconds per lookup
+unsigned long test(const LazyFlatSet& set, const std::vector<DataType>& keys) {
+    auto start = std::chrono::steady_clock::now();
+    
+    LazyFlatSet::size_type found = 0;
+    for (auto k : keys) {
+        found += set.count(k);
+    }
+    
+    auto duration = std::chrono::steady_clock::now() - start;
+    auto durationNS = std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
+    
+    // stop the compiler discarding the lookups
+    if (found > keys.size()) {
+        std::cerr << found << std::endl;
+    }
+    
+    return durationNS.count() / keys.size();
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<unsigned> sizes = { 1000 * 1000, 10 * 1000 * 1000, 100 * 1000 * 1000 };
+    if (argc > 1) {
+        sizes.assign(1, std::strtoul(argv[1], nullptr, 10));
+    }
+    
+    const unsigned lookups = 5 * 1000 * 1000;
+    
+    std::cout << R"("size", "lower_bound_equals hit [ns]", "search_index hit [ns]", "lower_bound_equals miss [ns]", "search_index miss [ns]")" << std::endl;
+    
+    for (auto size : sizes) {
+        // the set holds the even numbers so odd keys always miss
+        std::vector<DataType> data;
+        data.reserve(size);
+        for (unsigned i = 0; i < size; ++i) {
+            data.push_back(i * 2);
+        }
+        
+        LazyFlatSet set(128, 32 * 1024);
+        set.insert(data.begin(), data.end());
+        set.data();
+        
+        std::vector<DataType> hits, misses;
+        for (unsigned i = 0; i < lookups; ++i) {
+            auto k = data[std::rand() % size];
+            hits.push_back(k);
+            misses.push_back(k + 1);
+        }
+        
+        std::cout << size << ", ";
+        
+        set.search_index(false);
+        auto hit = test(set, hits);
+        auto miss = test(set, misses);
+        
+        set.search_index(true);
+        auto indexedHit = test(set, hits);
+        auto indexedMiss = test(set, misses);
+        
+        std::cout << hit << ", " << indexedHit << ", " << miss << ", " << indexedMiss << std::endl;
+    }
+    
+    return 0;
+}
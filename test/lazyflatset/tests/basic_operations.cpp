@@ -2,6 +2,16 @@
 
 #include <vector>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <set>
+#include <sstream>
+#include <string>
+#include <random>
+#include <stdexcept>
+#include <cmath>
+#include <cstring>
+#include <cstddef>
 
 #include "../../../lazyflatset.hpp"
 
@@ -499,3 +509,1733 @@ void basic_operations::test20() {
         CPPUNIT_ASSERT(copy2[i] == i);
     }
 }
+
+void basic_operations::test21() {
+    rs::ConcurrentLazyFlatSet<unsigned> set(16, 64);
+    const unsigned max = 1000;
+    for (unsigned i = 0; i < max; ++i) {
+        set.insert(max - i - 1);
+    }
+    
+    set.publish();
+    CPPUNIT_ASSERT_EQUAL(static_cast<rs::ConcurrentLazyFlatSet<unsigned>::size_type>(max), set.size());
+    
+    for (unsigned i = 0; i < max; ++i) {
+        unsigned v = 0;
+        CPPUNIT_ASSERT_EQUAL(1ul, set.count(i));
+        CPPUNIT_ASSERT(set.find(i, v));
+        CPPUNIT_ASSERT_EQUAL(i, v);
+    }
+    
+    for (unsigned i = 0; i < max; ++i) {
+        set.insert(i);
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(max));
+    CPPUNIT_ASSERT_EQUAL(1ul, set.erase(0));
+    CPPUNIT_ASSERT_EQUAL(0ul, set.erase(0));
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(0));
+    
+    auto snapshot = set.snapshot();
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(max - 1), snapshot->size());
+    for (unsigned i = 1; i < max; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i, (*snapshot)[i - 1]);
+    }
+    
+    set.clear();
+    CPPUNIT_ASSERT(set.empty());
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(max - 1), snapshot->size());
+}
+
+void basic_operations::test22() {
+    rs::ConcurrentLazyFlatSet<unsigned> set(16, 256);
+    const unsigned max = 20000;
+    std::atomic<bool> done(false);
+    std::atomic<unsigned> errors(0);
+    
+    std::vector<std::thread> readers;
+    for (unsigned r = 0; r < 4; ++r) {
+        readers.emplace_back([&]() {
+            while (!done) {
+                // published values are even, odd values are never inserted
+                auto size = set.size();
+                for (unsigned i = 1; i < max; i += 2) {
+                    if (set.count(i) != 0) {
+                        ++errors;
+                    }
+                }
+                if (set.size() < size) {
+                    ++errors;
+                }
+            }
+        });
+    }
+    
+    for (unsigned i = 0; i < max; i += 2) {
+        set.insert(i);
+    }
+    
+    set.flush();
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(0u, errors.load());
+    CPPUNIT_ASSERT_EQUAL(static_cast<rs::ConcurrentLazyFlatSet<unsigned>::size_type>(max / 2), set.size());
+    for (unsigned i = 0; i < max; i += 2) {
+        CPPUNIT_ASSERT_EQUAL(1ul, set.count(i));
+    }
+}
+
+void basic_operations::test23() {
+    rs::ShardedLazyFlatSet<unsigned> set(8, 16, 256, 1000);
+    const unsigned max = 100000;
+    const unsigned threads = 4;
+    
+    std::vector<std::thread> writers;
+    for (unsigned t = 0; t < threads; ++t) {
+        writers.emplace_back([&, t]() {
+            for (unsigned i = t; i < max; i += threads) {
+                set.insert(max - i - 1);
+            }
+        });
+    }
+    
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<rs::ShardedLazyFlatSet<unsigned>::size_type>(max), set.size());
+    
+    std::vector<unsigned> copy;
+    set.copy(copy);
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(max), copy.size());
+    for (unsigned i = 0; i < max; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i, copy[i]);
+        CPPUNIT_ASSERT_EQUAL(1ul, set.count(i));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(max));
+    
+    // the descending inserts should have forced the boundaries to be recalculated
+    for (unsigned i = 0; i < set.shards(); ++i) {
+        CPPUNIT_ASSERT(set.shard_size(i) > 0);
+    }
+}
+
+void basic_operations::test24() {
+    rs::ShardedLazyFlatSet<unsigned> set(4);
+    const unsigned max = 10000;
+    for (unsigned i = 0; i < max; ++i) {
+        set.insert(i);
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<rs::ShardedLazyFlatSet<unsigned>::size_type>(max), set.shard_size(0));
+    
+    set.rebalance();
+    for (unsigned i = 0; i < set.shards(); ++i) {
+        CPPUNIT_ASSERT_EQUAL(static_cast<rs::ShardedLazyFlatSet<unsigned>::size_type>(max / 4), set.shard_size(i));
+    }
+    
+    for (unsigned i = 0; i < max; i += 2) {
+        CPPUNIT_ASSERT_EQUAL(1ul, set.erase(i));
+    }
+    
+    unsigned next = 1;
+    set.for_each([&](unsigned k) {
+        CPPUNIT_ASSERT_EQUAL(next, k);
+        next += 2;
+    });
+    
+    unsigned v = 0;
+    CPPUNIT_ASSERT(set.find(max - 1, v));
+    CPPUNIT_ASSERT_EQUAL(max - 1, v);
+    CPPUNIT_ASSERT(!set.find(max - 2, v));
+    
+    set.clear();
+    CPPUNIT_ASSERT(set.empty());
+}
+
+void basic_operations::test25() {
+    std::vector<unsigned> data;
+    for (unsigned i = 0; i < 10000; ++i) {
+        data.push_back(i);
+        data.push_back(i);
+    }
+    
+    std::random_shuffle(data.begin(), data.end());
+    
+    rs::LazyFlatSet<unsigned> set;
+    set.insert(data.begin(), data.end());
+    CPPUNIT_ASSERT_EQUAL(10000ul, set.size());
+    
+    auto setData = set.data();
+    for (unsigned i = 0; i < 10000; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i, setData[i]);
+    }
+    
+    set.insert(data.begin(), data.end());
+    CPPUNIT_ASSERT_EQUAL(10000ul, set.size());
+}
+
+void basic_operations::test26() {
+    rs::LazyFlatSet<unsigned> set;
+    set.insert(5);
+    set.insert(1);
+    set.insert({ 4, 3, 3, 9, 0 });
+    set.insert(7);
+    CPPUNIT_ASSERT_EQUAL(7ul, set.size());
+    
+    set.insert({ 10, 11 });
+    set.insert({ });
+    CPPUNIT_ASSERT_EQUAL(9ul, set.size());
+    
+    std::vector<unsigned> copy;
+    set.copy(copy);
+    const unsigned expected[] = { 0, 1, 3, 4, 5, 7, 9, 10, 11 };
+    CPPUNIT_ASSERT(std::equal(copy.begin(), copy.end(), expected));
+}
+
+void basic_operations::test27() {
+    std::vector<unsigned> data;
+    for (unsigned i = 0; i < 100000; ++i) {
+        data.push_back(i * 2);
+    }
+    
+    std::random_shuffle(data.begin(), data.end());
+    
+    rs::LazyFlatSet<unsigned> set(16, 1024);
+    set.search_index(true);
+    CPPUNIT_ASSERT(set.search_index());
+    
+    for (unsigned i = 0; i < data.size(); ++i) {
+        set.insert(data[i]);
+    }
+    
+    set.data();
+    for (unsigned i = 0; i < 200000; ++i) {
+        unsigned v = 0;
+        CPPUNIT_ASSERT_EQUAL(static_cast<rs::LazyFlatSet<unsigned>::size_type>(i % 2 == 0 ? 1 : 0), set.count(i));
+        CPPUNIT_ASSERT_EQUAL(i % 2 == 0, set.find(i, v));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(200000));
+    
+    for (unsigned i = 0; i < 200000; i += 4) {
+        CPPUNIT_ASSERT_EQUAL(1ul, set.erase(i));
+    }
+    
+    set.insert(1);
+    set.data();
+    CPPUNIT_ASSERT_EQUAL(50001ul, set.size());
+    CPPUNIT_ASSERT_EQUAL(1ul, set.count(1));
+    CPPUNIT_ASSERT_EQUAL(1ul, set.count(2));
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(4));
+    CPPUNIT_ASSERT_EQUAL(1ul, set.count(199998));
+}
+
+void basic_operations::test28() {
+    for (unsigned size = 0; size < 300; ++size) {
+        rs::LazyFlatSet<unsigned> set(4, 8);
+        set.search_index(true);
+        for (unsigned i = 0; i < size; ++i) {
+            set.insert((i * 2) + 1);
+        }
+        
+        set.data();
+        for (unsigned i = 0; i <= size * 2; ++i) {
+            CPPUNIT_ASSERT_EQUAL(static_cast<rs::LazyFlatSet<unsigned>::size_type>(i % 2), set.count(i));
+        }
+        
+        set.search_index(false);
+        CPPUNIT_ASSERT(!set.search_index());
+        CPPUNIT_ASSERT_EQUAL(static_cast<rs::LazyFlatSet<unsigned>::size_type>(size), set.size());
+    }
+}
+
+template <class T>
+static void testUnsortedScan() {
+    rs::LazyFlatSet<T> set(100, 1024);
+    for (unsigned i = 0; i < 100; ++i) {
+        set.insert(static_cast<T>((i * 2) + 1));
+        CPPUNIT_ASSERT_EQUAL(static_cast<typename rs::LazyFlatSet<T>::size_type>(i + 1), set.size());
+        
+        for (unsigned j = 0; j <= (i * 2) + 2; ++j) {
+            CPPUNIT_ASSERT_EQUAL(static_cast<typename rs::LazyFlatSet<T>::size_type>(j % 2), set.count(static_cast<T>(j)));
+        }
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(1ul, set.erase(static_cast<T>(99)));
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(static_cast<T>(99)));
+    CPPUNIT_ASSERT_EQUAL(1ul, set.count(static_cast<T>(101)));
+}
+
+void basic_operations::test29() {
+    testUnsortedScan<unsigned char>();
+    testUnsortedScan<short>();
+    testUnsortedScan<unsigned>();
+    testUnsortedScan<long long>();
+    testUnsortedScan<float>();
+    testUnsortedScan<double>();
+    
+    rs::LazyFlatSet<int> set(64);
+    for (int i = -32; i < 32; ++i) {
+        set.insert(i);
+    }
+    
+    for (int i = -32; i < 32; ++i) {
+        CPPUNIT_ASSERT_EQUAL(1ul, set.count(i));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(-33));
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(32));
+}
+
+template <class T>
+static void testSortedSearch() {
+    std::vector<T> data;
+    for (unsigned size = 0; size < 100; ++size) {
+        for (unsigned i = 0; i <= (size * 2) + 1; ++i) {
+            auto k = static_cast<T>(i);
+            auto expected = std::lower_bound(data.begin(), data.end(), k) - data.begin();
+            auto actual = rs::LazyFlatSetSortedSearch<T, std::less<T>>::lower_bound(data.data(), data.size(), k);
+            CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(expected), actual);
+        }
+        
+        data.push_back(static_cast<T>((size * 2) + 1));
+    }
+}
+
+void basic_operations::test30() {
+    testSortedSearch<unsigned char>();
+    testSortedSearch<int>();
+    testSortedSearch<unsigned long>();
+    testSortedSearch<double>();
+}
+
+using LazyFlatSetBloomFilter = rs::LazyFlatSet<unsigned, std::less<unsigned>, std::equal_to<unsigned>, rs::LazyFlatSetQuickSort<unsigned, std::less<unsigned>>, std::allocator<unsigned>, false, rs::LazyFlatSetBloomFilter<unsigned>>;
+
+void basic_operations::test31() {
+    std::vector<unsigned> data;
+    for (unsigned i = 0; i < 20000; ++i) {
+        data.push_back(i * 2);
+    }
+    
+    std::random_shuffle(data.begin(), data.end());
+    
+    LazyFlatSetBloomFilter set(64, 1024);
+    CPPUNIT_ASSERT(set.filter_memory() > 0);
+    CPPUNIT_ASSERT_EQUAL(0ul, rs::LazyFlatSet<unsigned>().filter_memory());
+    
+    for (unsigned i = 0; i < data.size(); ++i) {
+        set.insert(data[i]);
+        CPPUNIT_ASSERT_EQUAL(1ul, set.count(data[i]));
+        CPPUNIT_ASSERT_EQUAL(0ul, set.count(data[i] + 1));
+    }
+    
+    for (unsigned i = 0; i < 40000; ++i) {
+        CPPUNIT_ASSERT_EQUAL(static_cast<LazyFlatSetBloomFilter::size_type>(i % 2 == 0 ? 1 : 0), set.count(i));
+    }
+    
+    for (unsigned i = 0; i < 40000; i += 4) {
+        CPPUNIT_ASSERT_EQUAL(1ul, set.erase(i));
+        set.emplace(i + 1);
+        CPPUNIT_ASSERT_EQUAL(1ul, set.count(i + 1));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(20000ul, set.size());
+    
+    set.clear();
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(2));
+}
+
+void basic_operations::test32() {
+    rs::LazyFlatSetBloomFilter<unsigned> filter(1000);
+    CPPUNIT_ASSERT(filter.memory() >= 1000 * 12 / 8);
+    
+    CPPUNIT_ASSERT(!filter.may_contain(0));
+    
+    for (unsigned i = 0; i < 1000; ++i) {
+        filter.insert(i);
+    }
+    
+    unsigned falsePositives = 0;
+    for (unsigned i = 0; i < 100000; ++i) {
+        CPPUNIT_ASSERT(i >= 1000 || filter.may_contain(i));
+        if (i >= 1000 && filter.may_contain(i)) {
+            ++falsePositives;
+        }
+    }
+    
+    CPPUNIT_ASSERT(falsePositives < 2000);
+    
+    filter.clear();
+    CPPUNIT_ASSERT(!filter.may_contain(42));
+}
+
+void basic_operations::test33() {
+    std::vector<unsigned> data;
+    for (unsigned i = 0; i < 1000; ++i) {
+        data.push_back(i);
+    }
+    
+    std::random_shuffle(data.begin(), data.end());
+    
+    rs::LazyFlatSet<unsigned> set(16, 64);
+    CPPUNIT_ASSERT(set.sorted().begin() == set.sorted().end());
+    
+    for (unsigned i = 0; i < data.size(); ++i) {
+        set.insert(data[i]);
+    }
+    
+    std::vector<unsigned> before;
+    set.copy(before, false);
+    
+    auto sorted = set.sorted();
+    CPPUNIT_ASSERT_EQUAL(static_cast<rs::LazyFlatSet<unsigned>::size_type>(data.size()), sorted.size());
+    
+    unsigned next = 0;
+    for (auto iter = sorted.begin(); iter != sorted.end(); ++iter) {
+        CPPUNIT_ASSERT_EQUAL(next++, *iter);
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<unsigned>(data.size()), next);
+    
+    // the set should not have been flushed by the iteration
+    std::vector<unsigned> after;
+    set.copy(after, false);
+    CPPUNIT_ASSERT(before == after);
+    CPPUNIT_ASSERT(!std::is_sorted(after.begin(), after.end()));
+    
+    std::vector<unsigned> copy(sorted.begin(), sorted.end());
+    CPPUNIT_ASSERT(std::is_sorted(copy.begin(), copy.end()));
+    CPPUNIT_ASSERT_EQUAL(data.size(), copy.size());
+}
+
+void basic_operations::test34() {
+    std::vector<unsigned> data;
+    for (unsigned i = 0; i < 1000; ++i) {
+        data.push_back(i * 2);
+    }
+    
+    std::random_shuffle(data.begin(), data.end());
+    
+    rs::LazyFlatSet<unsigned> set(16, 64);
+    for (unsigned i = 0; i < data.size(); ++i) {
+        set.insert(data[i]);
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(1000ul, set.count_range(0, 2000));
+    CPPUNIT_ASSERT_EQUAL(5ul, set.count_range(10, 20));
+    CPPUNIT_ASSERT_EQUAL(5ul, set.count_range(9, 19));
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count_range(20, 10));
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count_range(2000, 3000));
+    
+    for (unsigned lo = 0; lo < 2000; lo += 37) {
+        const auto hi = lo + 101;
+        const auto expected = ((std::min(hi, 2000u) + 1) / 2) - ((lo + 1) / 2);
+        CPPUNIT_ASSERT_EQUAL(static_cast<rs::LazyFlatSet<unsigned>::size_type>(expected), set.count_range(lo, hi));
+        
+        auto range = set.range(lo, hi);
+        CPPUNIT_ASSERT_EQUAL(static_cast<rs::LazyFlatSet<unsigned>::size_type>(expected), range.size());
+        
+        std::vector<unsigned> visited;
+        set.for_each_in_range(lo, hi, [&](unsigned k) { visited.push_back(k); });
+        CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(expected), visited.size());
+        CPPUNIT_ASSERT(std::equal(visited.begin(), visited.end(), range.begin()));
+        
+        for (unsigned i = 0; i < visited.size(); ++i) {
+            CPPUNIT_ASSERT_EQUAL(((lo + 1) / 2) * 2 + (i * 2), visited[i]);
+        }
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(1ul, set.equal_range(42).size());
+    CPPUNIT_ASSERT_EQUAL(42u, *set.equal_range(42).begin());
+    CPPUNIT_ASSERT_EQUAL(0ul, set.equal_range(43).size());
+    
+    unsigned v = 0;
+    CPPUNIT_ASSERT(set.lower_bound(42, v));
+    CPPUNIT_ASSERT_EQUAL(42u, v);
+    CPPUNIT_ASSERT(set.lower_bound(43, v));
+    CPPUNIT_ASSERT_EQUAL(44u, v);
+    CPPUNIT_ASSERT(set.upper_bound(42, v));
+    CPPUNIT_ASSERT_EQUAL(44u, v);
+    CPPUNIT_ASSERT(set.upper_bound(43, v));
+    CPPUNIT_ASSERT_EQUAL(44u, v);
+    CPPUNIT_ASSERT(!set.upper_bound(1998, v));
+    CPPUNIT_ASSERT(!set.lower_bound(1999, v));
+    
+    for (unsigned i = 0; i < 1998; ++i) {
+        CPPUNIT_ASSERT(set.upper_bound(i, v));
+        CPPUNIT_ASSERT_EQUAL((i / 2) * 2 + 2, v);
+    }
+}
+
+void basic_operations::test35() {
+    rs::LazyFlatSet<unsigned> set(16, 64);
+    set.deferred_erase(true);
+    CPPUNIT_ASSERT(set.deferred_erase());
+    
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.insert(i);
+    }
+    set.data();
+    
+    for (unsigned i = 0; i < 1000; i += 20) {
+        CPPUNIT_ASSERT_EQUAL(1ul, set.erase(i));
+        CPPUNIT_ASSERT_EQUAL(0ul, set.erase(i));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(950ul, set.size());
+    CPPUNIT_ASSERT(!set.empty());
+    
+    for (unsigned i = 0; i < 1000; ++i) {
+        unsigned v = 0;
+        CPPUNIT_ASSERT_EQUAL(i % 20 == 0 ? 0ul : 1ul, set.count(i));
+        CPPUNIT_ASSERT_EQUAL(i % 20 != 0, set.find(i, v));
+        CPPUNIT_ASSERT_EQUAL(i % 20 == 0 ? 0ul : 1ul, set.count_fn([&](unsigned k) { return k < i ? 1 : (k > i ? -1 : 0); }));
+    }
+    
+    set.insert(20);
+    set.insert(40, rs::LazyFlatSet<unsigned>::insert_hint::new_item);
+    CPPUNIT_ASSERT_EQUAL(952ul, set.size());
+    CPPUNIT_ASSERT_EQUAL(1ul, set.count(20));
+    CPPUNIT_ASSERT_EQUAL(1ul, set.count(40));
+    
+    CPPUNIT_ASSERT_EQUAL(95ul, set.count_range(100, 200));
+    CPPUNIT_ASSERT_EQUAL(952ul, set.sorted().size());
+    
+    unsigned v = 0;
+    CPPUNIT_ASSERT(set.lower_bound(60, v));
+    CPPUNIT_ASSERT_EQUAL(61u, v);
+    
+    std::vector<unsigned> values;
+    set.copy(values);
+    CPPUNIT_ASSERT_EQUAL(952ul, values.size());
+    CPPUNIT_ASSERT(std::is_sorted(values.begin(), values.end()));
+    CPPUNIT_ASSERT(std::adjacent_find(values.begin(), values.end()) == values.end());
+    
+    for (unsigned i = 0; i < 1000; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i % 20 == 0 && i != 20 && i != 40 ? 0ul : 1ul, set.count(i));
+    }
+}
+
+void basic_operations::test36() {
+    rs::LazyFlatSet<unsigned> set(16, 64);
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.insert(i);
+    }
+    set.data();
+    
+    set.deferred_erase(true);
+    set.search_index(true);
+    
+    // erasing most of the set forces several compactions along the way
+    for (unsigned i = 0; i < 1000; ++i) {
+        if (i % 10 != 0) {
+            CPPUNIT_ASSERT_EQUAL(1ul, set.erase_fn([&](unsigned k) { return k < i ? 1 : (k > i ? -1 : 0); }));
+        }
+        CPPUNIT_ASSERT_EQUAL((999ul - i) + (i / 10) + 1, set.size());
+    }
+    
+    for (unsigned i = 0; i < 1000; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i % 10 == 0 ? 1ul : 0ul, set.count(i));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(1ul, set.erase(500));
+    set.deferred_erase(false);
+    CPPUNIT_ASSERT_EQUAL(99ul, set.size());
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(500));
+    
+    unsigned erased = 0;
+    CPPUNIT_ASSERT_EQUAL(1ul, set.erase_fn([](unsigned k) { return k < 10 ? 1 : (k > 10 ? -1 : 0); }, [&](unsigned k) { erased = k; }));
+    CPPUNIT_ASSERT_EQUAL(10u, erased);
+    CPPUNIT_ASSERT_EQUAL(98ul, set.size());
+    
+    for (unsigned i = 0; i < 98; ++i) {
+        CPPUNIT_ASSERT(set[i] % 10 == 0 && set[i] != 10 && set[i] != 500);
+    }
+}
+
+void basic_operations::test37() {
+    rs::LazyFlatSet<unsigned> set(16, 64);
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.insert(i);
+        if (i == 900) {
+            set.data();
+        }
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(334ul, set.erase_if([](unsigned k) { return k % 3 == 0; }));
+    CPPUNIT_ASSERT_EQUAL(666ul, set.size());
+    CPPUNIT_ASSERT_EQUAL(0ul, set.erase_if([](unsigned k) { return k % 3 == 0; }));
+    
+    std::vector<unsigned> keys = { 998, 10, 4, 3, 2000, 10, 1, 500 };
+    CPPUNIT_ASSERT_EQUAL(5ul, set.erase(keys.begin(), keys.end()));
+    CPPUNIT_ASSERT_EQUAL(661ul, set.size());
+    CPPUNIT_ASSERT_EQUAL(0ul, set.erase(keys.begin(), keys.end()));
+    CPPUNIT_ASSERT_EQUAL(0ul, set.erase(keys.begin(), keys.begin()));
+    
+    CPPUNIT_ASSERT_EQUAL(67ul, set.erase(100, 200));
+    CPPUNIT_ASSERT_EQUAL(594ul, set.size());
+    CPPUNIT_ASSERT_EQUAL(0ul, set.erase(200, 100));
+    
+    for (unsigned i = 0; i < 1000; ++i) {
+        const auto erased = i % 3 == 0 || i == 998 || i == 10 || i == 4 || i == 1 || i == 500 || (i >= 100 && i < 200);
+        CPPUNIT_ASSERT_EQUAL(erased ? 0ul : 1ul, set.count(i));
+    }
+    
+    std::vector<unsigned> values;
+    set.copy(values);
+    CPPUNIT_ASSERT_EQUAL(594ul, values.size());
+    CPPUNIT_ASSERT(std::is_sorted(values.begin(), values.end()));
+}
+
+void basic_operations::test38() {
+    rs::LazyFlatSet<unsigned> set(16, 64);
+    set.search_index(true);
+    
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.insert(i);
+    }
+    
+    std::vector<unsigned> erased;
+    auto erase = [&](unsigned k) { erased.push_back(k); };
+    
+    CPPUNIT_ASSERT_EQUAL(500ul, set.erase_if([](unsigned k) { return k % 2 == 1; }, erase));
+    CPPUNIT_ASSERT_EQUAL(10ul, set.erase(0, 20, erase));
+    
+    std::vector<unsigned> keys = { 21, 22, 24, 26 };
+    CPPUNIT_ASSERT_EQUAL(3ul, set.erase(keys.begin(), keys.end(), erase));
+    
+    CPPUNIT_ASSERT_EQUAL(513ul, erased.size());
+    CPPUNIT_ASSERT_EQUAL(487ul, set.size());
+    
+    std::sort(erased.begin(), erased.end());
+    CPPUNIT_ASSERT(std::adjacent_find(erased.begin(), erased.end()) == erased.end());
+    
+    for (unsigned i = 0; i < 1000; ++i) {
+        const auto found = i % 2 == 0 && i >= 20 && i != 22 && i != 24 && i != 26;
+        CPPUNIT_ASSERT_EQUAL(found ? 1ul : 0ul, set.count(i));
+        CPPUNIT_ASSERT_EQUAL(!found, std::binary_search(erased.begin(), erased.end(), i));
+    }
+}
+
+void basic_operations::test39() {
+    rs::LazyFlatSet<unsigned> set(8, 16);
+    set.levels(3, 4);
+    CPPUNIT_ASSERT_EQUAL(3u, set.levels());
+    
+    std::set<unsigned> expected;
+    std::srand(39);
+    
+    for (unsigned i = 0; i < 20000; ++i) {
+        const unsigned k = std::rand() % 5000;
+        if (std::rand() % 4 == 0) {
+            CPPUNIT_ASSERT_EQUAL(static_cast<unsigned long>(expected.erase(k)), set.erase(k));
+        } else {
+            set.insert(k);
+            expected.insert(k);
+        }
+        
+        if (i % 1000 == 0) {
+            CPPUNIT_ASSERT_EQUAL(expected.size(), set.size());
+            
+            auto values = set.sorted();
+            CPPUNIT_ASSERT_EQUAL(expected.size(), values.size());
+            CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), values.begin()));
+            
+            auto range = set.range(1000, 2000);
+            CPPUNIT_ASSERT_EQUAL(set.count_range(1000, 2000), range.size());
+            CPPUNIT_ASSERT(std::equal(expected.lower_bound(1000), expected.lower_bound(2000), range.begin()));
+        }
+    }
+    
+    for (unsigned k = 0; k < 5000; ++k) {
+        unsigned v = 0;
+        CPPUNIT_ASSERT_EQUAL(static_cast<unsigned long>(expected.count(k)), set.count(k));
+        CPPUNIT_ASSERT_EQUAL(expected.count(k) > 0, set.find(k, v));
+        CPPUNIT_ASSERT_EQUAL(static_cast<unsigned long>(expected.count(k)), set.count_fn([&](unsigned i) { return k < i ? -1 : (k > i ? 1 : 0); }));
+        
+        auto bound = expected.lower_bound(k);
+        CPPUNIT_ASSERT_EQUAL(bound != expected.end(), set.lower_bound(k, v));
+        CPPUNIT_ASSERT(bound == expected.end() || *bound == v);
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(expected.size(), set.size());
+    CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), set.cbegin()));
+    CPPUNIT_ASSERT_EQUAL(expected.size(), static_cast<std::size_t>(set.cend() - set.cbegin()));
+}
+
+void basic_operations::test40() {
+    rs::LazyFlatSet<unsigned> set(4, 8);
+    set.levels(2);
+    
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.insert(i);
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(100ul, set.erase_if([](unsigned k) { return k % 10 == 0; }));
+    CPPUNIT_ASSERT_EQUAL(90ul, set.erase(100, 200));
+    
+    std::vector<unsigned> keys = { 1, 2, 3, 999 };
+    CPPUNIT_ASSERT_EQUAL(4ul, set.erase(keys.begin(), keys.end()));
+    CPPUNIT_ASSERT_EQUAL(806ul, set.size());
+    
+    unsigned erased = 0;
+    set.clear_fn([&](unsigned) { ++erased; });
+    CPPUNIT_ASSERT_EQUAL(806u, erased);
+    CPPUNIT_ASSERT(set.empty());
+    
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.insert(1000 - i, rs::LazyFlatSet<unsigned>::insert_hint::new_item);
+    }
+    
+    set.levels(0);
+    CPPUNIT_ASSERT_EQUAL(0u, set.levels());
+    CPPUNIT_ASSERT_EQUAL(1000ul, set.size());
+    for (unsigned i = 0; i < 1000; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i + 1, set[i]);
+    }
+}
+
+void basic_operations::test41() {
+    rs::LazyFlatSet<unsigned> ascending(4, 8);
+    ascending.adaptive(true);
+    CPPUNIT_ASSERT(ascending.adaptive());
+    
+    for (unsigned i = 0; i < 10000; ++i) {
+        ascending.insert(i * 2);
+        ascending.insert(i * 2);
+    }
+    
+    // out of order values go through the tiers, after a flush ascending values are appended again
+    ascending.insert(5);
+    ascending.insert(7, rs::LazyFlatSet<unsigned>::insert_hint::new_item);
+    ascending.data();
+    ascending.insert(20000);
+    
+    CPPUNIT_ASSERT_EQUAL(10003ul, ascending.size());
+    CPPUNIT_ASSERT(std::is_sorted(ascending.cbegin(), ascending.cend()));
+    CPPUNIT_ASSERT_EQUAL(1ul, ascending.count(5));
+    CPPUNIT_ASSERT_EQUAL(1ul, ascending.count(20000));
+    
+    std::set<unsigned> expected;
+    LazyFlatSetBloomFilter shuffled(4, 8);
+    shuffled.adaptive(true);
+    
+    std::srand(41);
+    for (unsigned i = 0; i < 100000; ++i) {
+        const unsigned k = std::rand();
+        shuffled.insert(k);
+        expected.insert(k);
+    }
+    
+    CPPUNIT_ASSERT(shuffled.max_unsorted_entries() > 4);
+    CPPUNIT_ASSERT(shuffled.max_nursery_entries() > 8);
+    CPPUNIT_ASSERT(shuffled.max_nursery_entries() <= 100000);
+    CPPUNIT_ASSERT_EQUAL(expected.size(), shuffled.size());
+    
+    for (auto k : expected) {
+        CPPUNIT_ASSERT_EQUAL(1ul, shuffled.count(k));
+    }
+    
+    CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), shuffled.cbegin()));
+}
+
+// compares unsigned values with signed keys, so lookups with an int key are transparent
+struct TransparentLess {
+    using is_transparent = void;
+    
+    template <class A, class B>
+    bool operator()(const A& a, const B& b) const {
+        return static_cast<long long>(a) < static_cast<long long>(b);
+    }
+};
+
+void basic_operations::test42() {
+    using StatsSet = rs::LazyFlatSet<unsigned, std::less<unsigned>, std::equal_to<unsigned>, rs::LazyFlatSetQuickSort<unsigned, std::less<unsigned>>, 
+        std::allocator<unsigned>, false, rs::LazyFlatSetNoFilter<unsigned>, rs::LazyFlatSetStats>;
+    
+    StatsSet set(4, 16);
+    
+    // ascending values append to the nursery and then to the main collection
+    for (unsigned i = 0; i < 64; ++i) {
+        set.insert(i * 2);
+    }
+    set.data();
+    
+    auto stats = set.stats();
+    CPPUNIT_ASSERT_EQUAL(16ul, stats.unsorted_flushes);
+    CPPUNIT_ASSERT_EQUAL(4ul, stats.nursery_flushes);
+    CPPUNIT_ASSERT_EQUAL(20ul, stats.append_merges);
+    CPPUNIT_ASSERT_EQUAL(0ul, stats.prepend_merges);
+    CPPUNIT_ASSERT_EQUAL(0ul, stats.inplace_merges);
+    CPPUNIT_ASSERT_EQUAL(128ul, stats.moved);
+    CPPUNIT_ASSERT(stats.comparisons > 0);
+    
+    set.reset_stats();
+    CPPUNIT_ASSERT_EQUAL(0ul, set.stats().comparisons);
+    CPPUNIT_ASSERT_EQUAL(0ul, set.stats().unsorted_flushes);
+    
+    set.insert(1);
+    set.insert(3);
+    set.insert(5);
+    set.insert(7);
+    set.insert(9);
+    CPPUNIT_ASSERT_EQUAL(1ul, set.stats().unsorted_flushes);
+    CPPUNIT_ASSERT_EQUAL(1ul, set.stats().append_merges);
+    
+    unsigned v = 0;
+    CPPUNIT_ASSERT_EQUAL(1ul, set.count(10));
+    CPPUNIT_ASSERT_EQUAL(1ul, set.count(3));
+    CPPUNIT_ASSERT(set.find(9, v));
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(11));
+    
+    stats = set.stats();
+    CPPUNIT_ASSERT_EQUAL(1ul, stats.main_hits);
+    CPPUNIT_ASSERT_EQUAL(1ul, stats.nursery_hits);
+    CPPUNIT_ASSERT_EQUAL(1ul, stats.unsorted_hits);
+    CPPUNIT_ASSERT_EQUAL(1ul, stats.misses);
+    
+    set.data();
+    CPPUNIT_ASSERT_EQUAL(1ul, set.stats().inplace_merges);
+    CPPUNIT_ASSERT_EQUAL(1ul, set.stats().nursery_flushes);
+    
+    rs::LazyFlatSet<unsigned> plain;
+    plain.insert(1);
+    CPPUNIT_ASSERT_EQUAL(1ul, plain.count(1));
+    CPPUNIT_ASSERT_EQUAL(0ul, plain.stats().main_hits + plain.stats().unsorted_hits + plain.stats().comparisons);
+    
+    // the comparison function and transparent lookups are counted as well
+    using TransparentStatsSet = rs::LazyFlatSet<unsigned, TransparentLess, std::equal_to<unsigned>, rs::LazyFlatSetQuickSort<unsigned, TransparentLess>, 
+        std::allocator<unsigned>, false, rs::LazyFlatSetNoFilter<unsigned>, rs::LazyFlatSetStats>;
+    
+    TransparentStatsSet transparent(4, 16);
+    for (unsigned i = 0; i < 8; ++i) {
+        transparent.insert(i);
+    }
+    transparent.data();
+    transparent.insert(9);
+    transparent.reset_stats();
+    
+    CPPUNIT_ASSERT_EQUAL(1ul, transparent.count(2));
+    CPPUNIT_ASSERT(transparent.find(9) != nullptr);
+    CPPUNIT_ASSERT(transparent.find(-1) == nullptr);
+    CPPUNIT_ASSERT_EQUAL(1ul, transparent.count_fn([](unsigned v) { return 3 - static_cast<int>(v); }));
+    CPPUNIT_ASSERT(transparent.find_fn([](unsigned v) { return 8 - static_cast<int>(v); }) == nullptr);
+    
+    stats = transparent.stats();
+    CPPUNIT_ASSERT_EQUAL(2ul, stats.main_hits);
+    CPPUNIT_ASSERT_EQUAL(1ul, stats.unsorted_hits);
+    CPPUNIT_ASSERT_EQUAL(2ul, stats.misses);
+}
+
+void basic_operations::test43() {
+    // a large main collection gallops over runs of main values, a small one merges value by value
+    for (unsigned size : { 8u, 64u * 1024u }) {
+        rs::LazyFlatSet<unsigned> set(4, 16);
+        for (unsigned i = 0; i < size; ++i) {
+            set.insert(i * 4);
+        }
+        set.data();
+        
+        std::vector<unsigned> values;
+        for (unsigned i = 0; i < 64; ++i) {
+            values.push_back(((i * 7919) % size) * 4 + 1);
+            values.push_back(((i * 104729) % size) * 4 + 2);
+        }
+        values.push_back(size * 4);
+        values.push_back(0);
+        
+        std::set<unsigned> expected(values.begin(), values.end());
+        for (unsigned i = 0; i < size; ++i) {
+            expected.insert(i * 4);
+        }
+        
+        for (auto v : values) {
+            set.insert(v);
+        }
+        
+        CPPUNIT_ASSERT_EQUAL(expected.size(), set.size());
+        CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), set.cbegin()));
+    }
+}
+
+void basic_operations::test44() {
+    struct Item {
+        unsigned key;
+        unsigned version;
+    };
+    
+    struct ItemLess {
+        bool operator()(const Item& a, const Item& b) const {
+            return a.key < b.key;
+        }
+    };
+    
+    struct ItemEqual {
+        bool operator()(const Item& a, const Item& b) const {
+            return a.key == b.key;
+        }
+    };
+    
+    rs::LazyFlatSet<Item, ItemLess, ItemEqual> set(8, 32);
+    set.levels(1, 2);
+    
+    // every key is inserted three times with the hint, once more after it has reached each sorted tier
+    for (unsigned version = 0; version < 3; ++version) {
+        for (unsigned i = 0; i < 200; ++i) {
+            set.insert(Item{ (i * 37) % 200, version }, decltype(set)::insert_hint::new_item);
+        }
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(200ul, set.size());
+    CPPUNIT_ASSERT_EQUAL(400ul, set.duplicates_removed());
+    
+    set.insert(Item{ 5, 3 }, decltype(set)::insert_hint::new_item);
+    set.insert(Item{ 5, 4 }, decltype(set)::insert_hint::new_item);
+    set.insert(Item{ 500, 0 }, decltype(set)::insert_hint::new_item);
+    
+    Item found{ 5, 0 };
+    CPPUNIT_ASSERT(set.find(Item{ 5, 0 }, found));
+    CPPUNIT_ASSERT_EQUAL(4u, found.version);
+    CPPUNIT_ASSERT_EQUAL(402ul, set.duplicates_removed());
+    
+    set.insert(Item{ 7, 5 }, decltype(set)::insert_hint::new_item);
+    CPPUNIT_ASSERT_EQUAL(1ul, set.erase(Item{ 7, 0 }));
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(Item{ 7, 0 }));
+    CPPUNIT_ASSERT_EQUAL(200ul, set.size());
+    
+    auto data = set.data();
+    for (unsigned i = 0; i < set.size(); ++i) {
+        CPPUNIT_ASSERT(i == 0 || data[i - 1].key < data[i].key);
+        CPPUNIT_ASSERT_EQUAL(data[i].key == 5 ? 4u : data[i].key == 500 ? 0u : 2u, data[i].version);
+    }
+    
+    rs::LazyFlatSet<unsigned> plain;
+    plain.insert(1, rs::LazyFlatSet<unsigned>::insert_hint::new_item);
+    plain.insert(2);
+    CPPUNIT_ASSERT_EQUAL(2ul, plain.size());
+    CPPUNIT_ASSERT_EQUAL(0ul, plain.duplicates_removed());
+}
+
+void basic_operations::test45() {
+    rs::LazyFlatSet<unsigned> set(8, 64);
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.insert(((i * 7919) % 1000) * 2);
+    }
+    CPPUNIT_ASSERT(set.save("lazyflatset_test45.bin"));
+    
+    rs::MappedLazyFlatSet<unsigned> mapped;
+    CPPUNIT_ASSERT(!mapped.open("lazyflatset_test45.missing"));
+    CPPUNIT_ASSERT(mapped.open("lazyflatset_test45.bin"));
+    CPPUNIT_ASSERT(mapped.is_open());
+    CPPUNIT_ASSERT_EQUAL(1000ul, mapped.size());
+    CPPUNIT_ASSERT_EQUAL(1000ul, mapped.mapped_size());
+    CPPUNIT_ASSERT(std::equal(set.cbegin(), set.cend(), mapped.cbegin()));
+    
+    unsigned v = 0;
+    CPPUNIT_ASSERT(mapped.contains(0));
+    CPPUNIT_ASSERT(mapped.contains(1998));
+    CPPUNIT_ASSERT(!mapped.contains(1));
+    CPPUNIT_ASSERT(mapped.find(42, v));
+    CPPUNIT_ASSERT_EQUAL(42u, v);
+    
+    // new values go to the overlay, erased values are hidden until the snapshot is saved again
+    mapped.insert(1);
+    mapped.insert(2001);
+    mapped.insert(42);
+    CPPUNIT_ASSERT_EQUAL(1ul, mapped.erase(100));
+    CPPUNIT_ASSERT_EQUAL(0ul, mapped.erase(100));
+    CPPUNIT_ASSERT_EQUAL(1ul, mapped.erase(1));
+    CPPUNIT_ASSERT_EQUAL(1000ul, mapped.size());
+    CPPUNIT_ASSERT_EQUAL(2ul, mapped.overlay().size());
+    CPPUNIT_ASSERT(mapped.contains(42));
+    CPPUNIT_ASSERT(!mapped.contains(100));
+    CPPUNIT_ASSERT(mapped.contains(2001));
+    
+    std::vector<unsigned> expected(set.cbegin(), set.cend());
+    expected.erase(std::find(expected.begin(), expected.end(), 100u));
+    expected.push_back(2001);
+    CPPUNIT_ASSERT_EQUAL(expected.size(), static_cast<std::size_t>(std::distance(mapped.cbegin(), mapped.cend())));
+    CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), mapped.cbegin()));
+    
+    // the merged values replace the snapshot while it is still mapped
+    CPPUNIT_ASSERT(mapped.save("lazyflatset_test45.bin"));
+    CPPUNIT_ASSERT(mapped.contains(2001));
+    CPPUNIT_ASSERT(mapped.open("lazyflatset_test45.bin"));
+    CPPUNIT_ASSERT_EQUAL(1000ul, mapped.mapped_size());
+    CPPUNIT_ASSERT_EQUAL(0ul, mapped.overlay().size());
+    CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), mapped.cbegin()));
+    
+    rs::MappedLazyFlatSet<std::uint64_t> wide;
+    CPPUNIT_ASSERT(!wide.open("lazyflatset_test45.bin"));
+    CPPUNIT_ASSERT(!wide.is_open());
+    
+    mapped.close();
+    CPPUNIT_ASSERT(mapped.empty());
+    std::remove("lazyflatset_test45.bin");
+}
+
+void basic_operations::test46() {
+    rs::LazyFlatSet<unsigned> set(8, 64);
+    for (unsigned i = 0; i < 5000; ++i) {
+        set.insert((i * 7919) % 5000);
+    }
+    set.insert(6000);
+    
+    std::stringstream stream;
+    CPPUNIT_ASSERT(set.serialize(stream));
+    
+    rs::LazyFlatSet<unsigned> loaded;
+    loaded.insert(7000);
+    CPPUNIT_ASSERT(loaded.deserialize(stream, true));
+    CPPUNIT_ASSERT_EQUAL(5001ul, loaded.size());
+    CPPUNIT_ASSERT(std::equal(set.cbegin(), set.cend(), loaded.cbegin()));
+    CPPUNIT_ASSERT(loaded.contains(6000));
+    CPPUNIT_ASSERT(!loaded.contains(7000));
+    
+    // the loaded set carries on as usual
+    loaded.insert(5500);
+    CPPUNIT_ASSERT(loaded.erase(0) == 1);
+    CPPUNIT_ASSERT_EQUAL(5001ul, loaded.size());
+    
+    // a flipped payload byte fails the checksum and leaves the set empty
+    auto bytes = stream.str();
+    bytes[bytes.size() - 3] ^= 1;
+    std::stringstream corrupt(bytes);
+    CPPUNIT_ASSERT(!loaded.deserialize(corrupt));
+    CPPUNIT_ASSERT(loaded.empty());
+    
+    std::stringstream truncated(stream.str().substr(0, 100));
+    CPPUNIT_ASSERT(!loaded.deserialize(truncated));
+    
+    // values out of order are only caught by the validation pass
+    rs::LazyFlatSet<unsigned, std::greater<unsigned>> descending;
+    descending.insert(1);
+    descending.insert(2);
+    std::stringstream reversed;
+    CPPUNIT_ASSERT(descending.serialize(reversed));
+    CPPUNIT_ASSERT(loaded.deserialize(reversed));
+    reversed.seekg(0);
+    CPPUNIT_ASSERT(!loaded.deserialize(reversed, true));
+    
+    rs::LazyFlatSet<std::string> strings;
+    for (unsigned i = 0; i < 1000; ++i) {
+        strings.insert(std::string(i % 37, 'a' + (i % 26)) + std::to_string(i));
+    }
+    strings.insert(std::string());
+    
+    std::stringstream stringStream;
+    CPPUNIT_ASSERT(strings.serialize(stringStream));
+    
+    rs::LazyFlatSet<std::string> loadedStrings;
+    CPPUNIT_ASSERT(loadedStrings.deserialize(stringStream, true));
+    CPPUNIT_ASSERT_EQUAL(strings.size(), loadedStrings.size());
+    CPPUNIT_ASSERT(std::equal(strings.cbegin(), strings.cend(), loadedStrings.cbegin()));
+    CPPUNIT_ASSERT(loadedStrings.contains(std::string()));
+    
+    stringStream.seekg(0);
+    rs::LazyFlatSet<std::uint64_t> wide;
+    CPPUNIT_ASSERT(!wide.deserialize(stringStream));
+}
+
+void basic_operations::test47() {
+    struct CountingResource : public rs::LazyFlatSetMemoryResource {
+        CountingResource() : allocations(0), deallocations(0) {}
+        
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+            ++allocations;
+            return default_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+            ++deallocations;
+            default_resource()->deallocate(p, bytes, alignment);
+        }
+
+        bool do_is_equal(const rs::LazyFlatSetMemoryResource& other) const noexcept override {
+            return this == &other;
+        }
+        
+        unsigned allocations;
+        unsigned deallocations;
+    };
+    
+    using Allocator = rs::LazyFlatSetPolymorphicAllocator<unsigned>;
+    using ArenaSet = rs::LazyFlatSet<unsigned, std::less<unsigned>, std::equal_to<unsigned>, rs::LazyFlatSetQuickSort<unsigned, std::less<unsigned>>, Allocator>;
+    
+    CountingResource heap;
+    CountingResource upstream;
+    {
+        // the small tiers live in the arena, the main collection on the heap
+        rs::LazyFlatSetArenaResource arena(64 * 1024, &upstream);
+        ArenaSet set(16, 256, Allocator(&heap), Allocator(&arena), Allocator(&arena));
+        for (unsigned i = 0; i < 20000; ++i) {
+            set.insert((i * 7919) % 20000);
+        }
+        
+        CPPUNIT_ASSERT_EQUAL(20000ul, set.size());
+        for (unsigned i = 0; i < 20000; ++i) {
+            CPPUNIT_ASSERT_EQUAL(i, set[i]);
+        }
+        
+        // the nursery and unsorted buffers are reused from the free lists rather than taken upstream
+        CPPUNIT_ASSERT_EQUAL(1u, upstream.allocations);
+        CPPUNIT_ASSERT(heap.allocations > 0);
+        CPPUNIT_ASSERT(arena.upstream_bytes() >= 64 * 1024);
+        
+        ArenaSet copy(set);
+        CPPUNIT_ASSERT(copy.size() == set.size());
+    }
+    CPPUNIT_ASSERT_EQUAL(upstream.allocations, upstream.deallocations);
+    CPPUNIT_ASSERT_EQUAL(heap.allocations, heap.deallocations);
+    
+    // short lived sets served from a buffer on the stack never reach the upstream resource
+    alignas(16) char buffer[16 * 1024];
+    for (unsigned request = 0; request < 1000; ++request) {
+        rs::LazyFlatSetArenaResource arena(buffer, sizeof(buffer), 64 * 1024, &upstream);
+        ArenaSet set(16, 128, Allocator(&arena));
+        for (unsigned i = 0; i < 200; ++i) {
+            set.insert((i * 31) % 200);
+        }
+        CPPUNIT_ASSERT_EQUAL(200ul, set.size());
+        CPPUNIT_ASSERT_EQUAL(0ul, arena.upstream_bytes());
+    }
+    CPPUNIT_ASSERT_EQUAL(1u, upstream.allocations);
+    
+    // the sort policy takes whatever iterator the collections use
+    rs::LazyFlatSet<unsigned, std::less<unsigned>, std::equal_to<unsigned>, rs::LazyFlatSetQuickSort<unsigned, std::less<unsigned>>, Allocator> plain;
+    plain.insert(2);
+    plain.insert(1);
+    CPPUNIT_ASSERT_EQUAL(1u, plain[0]);
+}
+
+void basic_operations::test48() {
+#if defined(RS_LAZY_FLAT_SET_MREMAP)
+    using MappedSet = rs::LazyFlatSet<unsigned, std::less<unsigned>, std::equal_to<unsigned>, rs::LazyFlatSetQuickSort<unsigned, std::less<unsigned>>, 
+        rs::LazyFlatSetMappedAllocator<unsigned>>;
+    
+    // the main collection passes the 2MB threshold and is then grown by remapping
+    const unsigned size = 3 * 1000 * 1000;
+    MappedSet set(128, 32 * 1024);
+    for (unsigned i = 0; i < size; ++i) {
+        set.insert(static_cast<unsigned>((i * 7919ull) % size));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(size), set.size());
+    auto data = set.data();
+    for (unsigned i = 0; i < size; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i, data[i]);
+    }
+    
+    // ascending values are appended straight to the main collection
+    MappedSet ascending;
+    ascending.adaptive(true);
+    for (unsigned i = 0; i < size; ++i) {
+        ascending.insert(i * 2);
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(size), ascending.size());
+    CPPUNIT_ASSERT(std::equal(ascending.cbegin(), ascending.cend(), set.cbegin(), [](unsigned a, unsigned b) { return a == b * 2; }));
+    CPPUNIT_ASSERT(ascending.contains((size - 1) * 2));
+    CPPUNIT_ASSERT(!ascending.contains(1));
+    
+    MappedSet copy(ascending);
+    CPPUNIT_ASSERT(std::equal(ascending.cbegin(), ascending.cend(), copy.cbegin()));
+    
+    // a mapped block keeps its values when it is remapped, blocks below the threshold are left alone
+    rs::LazyFlatSetMappedAllocator<unsigned> allocator;
+    const std::size_t count = rs::LazyFlatSetMappedAllocator<unsigned>::mapThreshold / sizeof(unsigned);
+    auto block = allocator.allocate(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        block[i] = static_cast<unsigned>(i);
+    }
+    
+    auto remapped = rs::LazyFlatSetMappedAllocator<unsigned>::reallocate(block, count, count * 4);
+    CPPUNIT_ASSERT(remapped != nullptr);
+    for (std::size_t i = 0; i < count; ++i) {
+        CPPUNIT_ASSERT_EQUAL(static_cast<unsigned>(i), remapped[i]);
+    }
+    remapped[(count * 4) - 1] = 42;
+    allocator.deallocate(remapped, count * 4);
+    
+    auto small = allocator.allocate(16);
+    CPPUNIT_ASSERT(rs::LazyFlatSetMappedAllocator<unsigned>::reallocate(small, 16, 32) == nullptr);
+    CPPUNIT_ASSERT(rs::LazyFlatSetMappedAllocator<unsigned>::reallocate(block, count, 16) == nullptr);
+    allocator.deallocate(small, 16);
+    
+    // a plain vector can use the allocator and values are value initialized as usual
+    std::vector<unsigned, rs::LazyFlatSetMappedAllocator<unsigned>> zeroed(count * 2);
+    CPPUNIT_ASSERT(std::all_of(zeroed.cbegin(), zeroed.cend(), [](unsigned v) { return v == 0; }));
+    
+    // the buffer keeps its values as it grows past the threshold and is remapped
+    rs::LazyFlatSetMappedBuffer<unsigned> buffer;
+    for (std::size_t i = 0; i < count * 3; ++i) {
+        buffer.push_back(static_cast<unsigned>(i * 2));
+    }
+    buffer.insert(buffer.begin() + 1, 1u);
+    buffer.erase(buffer.begin() + 2, buffer.begin() + 4);
+    buffer.resize(buffer.size() + 2);
+    CPPUNIT_ASSERT_EQUAL(count * 3 + 1, buffer.size());
+    CPPUNIT_ASSERT_EQUAL(1u, buffer[1]);
+    CPPUNIT_ASSERT_EQUAL(6u, buffer[2]);
+    CPPUNIT_ASSERT_EQUAL(0u, buffer.back());
+    
+    buffer.resize(8);
+    buffer.shrink_to_fit();
+    CPPUNIT_ASSERT_EQUAL(std::size_t(8), buffer.capacity());
+    rs::LazyFlatSetMappedBuffer<unsigned> moved(std::move(buffer));
+    CPPUNIT_ASSERT(buffer.empty());
+    CPPUNIT_ASSERT_EQUAL(16u, moved.back());
+    
+    // every tier operation works on the buffer
+    MappedSet tiers(16, 256);
+    tiers.parallel(true, 1 << 12);
+    tiers.levels(2, 4);
+    for (unsigned i = 0; i < 100000; ++i) {
+        tiers.insert(static_cast<unsigned>((i * 7919ull) % 100000));
+    }
+    CPPUNIT_ASSERT_EQUAL(std::size_t(100000), tiers.sorted().size());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(10), tiers.count_range(10, 20));
+    CPPUNIT_ASSERT_EQUAL(std::size_t(50000), tiers.erase_if([](unsigned v) { return v % 2 == 1; }));
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), tiers.erase(2u));
+    CPPUNIT_ASSERT(!tiers.contains(2));
+    CPPUNIT_ASSERT_EQUAL(std::size_t(50000), tiers.set_union(ascending.cbegin(), ascending.cbegin() + 10).size());
+    
+    std::stringstream stream;
+    CPPUNIT_ASSERT(tiers.serialize(stream));
+    MappedSet loaded;
+    CPPUNIT_ASSERT(loaded.deserialize(stream, true));
+    CPPUNIT_ASSERT(std::equal(loaded.cbegin(), loaded.cend(), tiers.cbegin()));
+    loaded.shrink_to_fit();
+    CPPUNIT_ASSERT_EQUAL(std::size_t(49999), loaded.size());
+#endif
+}
+
+template <class Set>
+static bool equals(const std::vector<typename Set::value_type>& expected, const Set& set) {
+    return expected.size() == set.size() && std::equal(expected.begin(), expected.end(), set.cbegin());
+}
+
+template <class Set>
+static void checkSetAlgebra(const Set& a, const Set& b) {
+    using value_type = typename Set::value_type;
+    std::vector<value_type> aValues(a.cbegin(), a.cend()), bValues(b.cbegin(), b.cend());
+    
+    std::vector<value_type> unionValues;
+    std::set_union(aValues.begin(), aValues.end(), bValues.begin(), bValues.end(), std::back_inserter(unionValues));
+    CPPUNIT_ASSERT(equals(unionValues, a.set_union(b)));
+    CPPUNIT_ASSERT(equals(unionValues, b.set_union(a)));
+    
+    std::vector<value_type> intersection;
+    std::set_intersection(aValues.begin(), aValues.end(), bValues.begin(), bValues.end(), std::back_inserter(intersection));
+    CPPUNIT_ASSERT(equals(intersection, a.set_intersection(b)));
+    CPPUNIT_ASSERT(equals(intersection, b.set_intersection(a)));
+    
+    std::vector<value_type> difference;
+    std::set_difference(aValues.begin(), aValues.end(), bValues.begin(), bValues.end(), std::back_inserter(difference));
+    CPPUNIT_ASSERT(equals(difference, a.set_difference(b)));
+    
+    std::vector<value_type> symmetricDifference;
+    std::set_symmetric_difference(aValues.begin(), aValues.end(), bValues.begin(), bValues.end(), std::back_inserter(symmetricDifference));
+    CPPUNIT_ASSERT(equals(symmetricDifference, a.set_symmetric_difference(b)));
+    
+    CPPUNIT_ASSERT(a.includes(b) == std::includes(aValues.begin(), aValues.end(), bValues.begin(), bValues.end()));
+    CPPUNIT_ASSERT(b.includes(a) == std::includes(bValues.begin(), bValues.end(), aValues.begin(), aValues.end()));
+    CPPUNIT_ASSERT(a.includes(a.set_intersection(b)));
+}
+
+void basic_operations::test49() {
+    // sizes around the galloping ratio in both directions, with values in both sets and neither
+    const unsigned sizes[][2] = { { 0, 0 }, { 0, 100 }, { 1000, 1000 }, { 5000, 37 }, { 37, 5000 }, { 100000, 100 }, { 20, 100000 }, { 3000, 2999 } };
+    for (const auto& size : sizes) {
+        rs::LazyFlatSet<unsigned> a, b;
+        rs::LazyFlatSet<std::uint64_t> wideA, wideB;
+        rs::LazyFlatSet<std::string> stringA, stringB;
+        for (unsigned i = 0; i < size[0]; ++i) {
+            a.insert(i * 3);
+            wideA.insert((std::uint64_t(i) * 3) << 33);
+            stringA.insert(std::to_string(i * 3));
+        }
+        for (unsigned i = 0; i < size[1]; ++i) {
+            b.insert(i * 5 + (i % 7));
+            wideB.insert((std::uint64_t(i) * 5 + (i % 7)) << 33);
+            stringB.insert(std::to_string(i * 5 + (i % 7)));
+        }
+        
+        checkSetAlgebra(a, b);
+        checkSetAlgebra(wideA, wideB);
+        checkSetAlgebra(stringA, stringB);
+    }
+    
+    // sorted ranges, as pointers and as other iterators
+    rs::LazyFlatSet<unsigned> set;
+    for (unsigned i = 0; i < 100; ++i) {
+        set.insert(i);
+    }
+    
+    std::set<unsigned> odd;
+    for (unsigned i = 1; i < 200; i += 2) {
+        odd.insert(i);
+    }
+    std::vector<unsigned> oddValues(odd.begin(), odd.end());
+    
+    CPPUNIT_ASSERT_EQUAL(50ul, set.set_intersection(odd.begin(), odd.end()).size());
+    CPPUNIT_ASSERT_EQUAL(50ul, set.set_intersection(oddValues.data(), oddValues.data() + oddValues.size()).size());
+    CPPUNIT_ASSERT_EQUAL(150ul, set.set_union(odd.begin(), odd.end()).size());
+    CPPUNIT_ASSERT_EQUAL(50ul, set.set_difference(oddValues.data(), oddValues.data() + oddValues.size()).size());
+    CPPUNIT_ASSERT_EQUAL(100ul, set.set_symmetric_difference(odd.begin(), odd.end()).size());
+    CPPUNIT_ASSERT(!set.includes(odd.begin(), odd.end()));
+    CPPUNIT_ASSERT(set.includes(odd.begin(), odd.find(99)));
+    
+    // unflushed values take part
+    set.insert(1001);
+    odd.insert(1001);
+    CPPUNIT_ASSERT_EQUAL(51ul, set.set_intersection(odd.begin(), odd.end()).size());
+}
+
+template <class Set, class Make>
+static void checkParallel(Set& set, unsigned size, Make make) {
+    std::set<typename Set::value_type> expected;
+    std::mt19937 random(size);
+    
+    // random values flush the nursery into the main collection in many overlapping merges
+    for (unsigned i = 0; i < size; ++i) {
+        auto value = make(random() % (size * 4));
+        set.insert(value);
+        expected.insert(value);
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(expected.size(), set.size());
+    CPPUNIT_ASSERT(std::equal(expected.cbegin(), expected.cend(), set.cbegin()));
+    
+    // a bulk insert sorts the batch
+    std::vector<typename Set::value_type> batch;
+    for (unsigned i = 0; i < size; ++i) {
+        batch.push_back(make(random()));
+    }
+    set.insert(batch.begin(), batch.end());
+    expected.insert(batch.begin(), batch.end());
+    
+    CPPUNIT_ASSERT_EQUAL(expected.size(), set.size());
+    CPPUNIT_ASSERT(std::equal(expected.cbegin(), expected.cend(), set.cbegin()));
+}
+
+void basic_operations::test50() {
+    rs::LazyFlatSetThreadPool pool(3);
+    CPPUNIT_ASSERT_EQUAL(4u, pool.concurrency());
+    
+    rs::LazyFlatSet<unsigned> set(16, 256);
+    CPPUNIT_ASSERT(!set.parallel());
+    set.parallel(true, 64, &pool);
+    CPPUNIT_ASSERT(set.parallel());
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(64), set.parallel_threshold());
+    checkParallel(set, 20000, [](unsigned i) { return i; });
+    
+    // the nursery is much smaller than the main collection so the merge pieces gallop
+    rs::LazyFlatSet<unsigned> galloping(4, 16);
+    galloping.parallel(true, 64, &pool);
+    checkParallel(galloping, 5000, [](unsigned i) { return i; });
+    
+    rs::LazyFlatSet<std::string> strings(16, 256);
+    strings.parallel(true, 64, &pool);
+    checkParallel(strings, 5000, [](unsigned i) { return std::to_string(i); });
+    
+    // below the threshold the calling thread does the work
+    rs::LazyFlatSet<unsigned> small(16, 256);
+    small.parallel(true);
+    checkParallel(small, 1000, [](unsigned i) { return i; });
+    
+    // every task runs even when one throws, the exception reaches the caller
+    std::atomic<unsigned> calls(0);
+    bool thrown = false;
+    try {
+        pool.run(16, [&](std::size_t i) {
+            ++calls;
+            if (i == 7) {
+                throw std::runtime_error("task");
+            }
+        });
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CPPUNIT_ASSERT(thrown);
+    CPPUNIT_ASSERT_EQUAL(16u, calls.load());
+}
+
+struct FirstLess {
+    bool operator()(const std::pair<unsigned, unsigned>& a, const std::pair<unsigned, unsigned>& b) const {
+        return a.first < b.first;
+    }
+};
+
+struct FirstEqual {
+    bool operator()(const std::pair<unsigned, unsigned>& a, const std::pair<unsigned, unsigned>& b) const {
+        return a.first == b.first;
+    }
+};
+
+void basic_operations::test51() {
+    using Value = std::pair<unsigned, unsigned>;
+    rs::ConcurrentLazyFlatSet<Value, FirstLess, FirstEqual, rs::LazyFlatSetQuickSort<Value, FirstLess>> set(16, 8);
+    for (unsigned i = 0; i < 8; ++i) {
+        set.insert(Value(i, 0));
+    }
+    set.publish();
+    
+    // the second publish overflows the nursery, the re-inserted key must only survive once
+    set.insert(Value(3, 1));
+    set.insert(Value(100, 1));
+    set.publish();
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(9), set.size());
+    Value v;
+    CPPUNIT_ASSERT(set.find(Value(3, 0), v));
+    CPPUNIT_ASSERT_EQUAL(1u, v.second);
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), set.erase(Value(3, 0)));
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(0), set.count(Value(3, 0)));
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(8), set.size());
+    
+    auto snapshot = set.snapshot();
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(8), snapshot->size());
+    CPPUNIT_ASSERT(std::adjacent_find(snapshot->cbegin(), snapshot->cend(), FirstEqual()) == snapshot->cend());
+}
+
+void basic_operations::test52() {
+    const unsigned capacity = 100000;
+    const unsigned queries = 1000000;
+    rs::LazyFlatSetBloomFilter<unsigned> filter(capacity);
+    for (unsigned i = 0; i < capacity; ++i) {
+        filter.insert(i * 3);
+    }
+    
+    unsigned falsePositives = 0;
+    for (unsigned i = 0; i < queries; ++i) {
+        falsePositives += filter.may_contain(i * 3 + 1) ? 1 : 0;
+    }
+    
+    // the rate a classic filter of 12 bits per value and 7 probes would reach, blocking costs a little more
+    const double target = std::pow(1 - std::exp(-7.0 / 12), 7);
+    CPPUNIT_ASSERT(static_cast<double>(falsePositives) / queries < target * 1.5);
+}
+
+void basic_operations::test53() {
+    rs::LazyFlatSet<unsigned> set(4, 8);
+    set.adaptive(true);
+    
+    std::srand(53);
+    for (unsigned i = 0; i < 200000; ++i) {
+        set.insert(std::rand() % 1000000);
+    }
+    set.data();
+    
+    const auto grownUnsorted = set.max_unsorted_entries();
+    const auto grownNursery = set.max_nursery_entries();
+    CPPUNIT_ASSERT(grownUnsorted > 16);
+    CPPUNIT_ASSERT(grownNursery > 1000);
+    
+    // a small shrink keeps the sizes, once the set is far smaller the tiers shrink at the next flush
+    set.erase(0, 100000);
+    set.insert(5);
+    set.data();
+    CPPUNIT_ASSERT_EQUAL(grownUnsorted, set.max_unsorted_entries());
+    CPPUNIT_ASSERT_EQUAL(grownNursery, set.max_nursery_entries());
+    
+    set.erase(10, 1000000);
+    set.insert(1000);
+    set.insert(500);
+    set.data();
+    CPPUNIT_ASSERT(set.max_unsorted_entries() < grownUnsorted);
+    CPPUNIT_ASSERT(set.max_nursery_entries() < grownNursery);
+    CPPUNIT_ASSERT(set.max_unsorted_entries() >= 4);
+    CPPUNIT_ASSERT(set.max_nursery_entries() >= 8);
+    
+    set.clear();
+    CPPUNIT_ASSERT_EQUAL(4u, set.max_unsorted_entries());
+    CPPUNIT_ASSERT_EQUAL(8u, set.max_nursery_entries());
+    
+    // ascending values are appended past the search index, which stays in use until the set doubles
+    rs::LazyFlatSet<unsigned> indexed(4, 8);
+    indexed.adaptive(true);
+    indexed.search_index(true);
+    for (unsigned i = 0; i < 10000; ++i) {
+        indexed.insert(i * 2);
+        CPPUNIT_ASSERT_EQUAL(1ul, indexed.count(i * 2));
+        CPPUNIT_ASSERT_EQUAL(0ul, indexed.count((i * 2) + 1));
+    }
+}
+
+void basic_operations::test54() {
+    rs::LazyFlatSet<unsigned> set(16, 64);
+    set.insert(1);
+    set.insert(2);
+    set.data();
+    
+    // the hinted value duplicates one in the main collection, an unsorted copy must not see it twice
+    set.insert(1, rs::LazyFlatSet<unsigned>::insert_hint::new_item);
+    set.insert(3, rs::LazyFlatSet<unsigned>::insert_hint::new_item);
+    
+    std::vector<unsigned> unsorted;
+    set.copy(unsorted, false);
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(3), unsorted.size());
+    std::sort(unsorted.begin(), unsorted.end());
+    CPPUNIT_ASSERT(std::adjacent_find(unsorted.begin(), unsorted.end()) == unsorted.end());
+    CPPUNIT_ASSERT_EQUAL(set.size(), unsorted.size());
+    CPPUNIT_ASSERT_EQUAL(1ul, set.duplicates_removed());
+}
+
+// overwrites the 64 bit field at offset in a serialized set
+static std::string patch(std::string bytes, std::size_t offset, std::uint64_t value) {
+    std::memcpy(&bytes[offset], &value, sizeof(value));
+    return bytes;
+}
+
+// a stream buffer that can't seek, so a reader can't tell how much data is left
+struct UnseekableBuffer : std::streambuf {
+    UnseekableBuffer(std::string bytes) : bytes_(std::move(bytes)) {
+        setg(&bytes_[0], &bytes_[0], &bytes_[0] + bytes_.size());
+    }
+    
+    std::string bytes_;
+};
+
+void basic_operations::test55() {
+    rs::LazyFlatSet<unsigned> set;
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.insert(i);
+    }
+    
+    std::stringstream stream;
+    CPPUNIT_ASSERT(set.serialize(stream));
+    
+    // a corrupt count far larger than memory is bad input, not an allocation failure
+    const auto countOffset = offsetof(rs::LazyFlatSetStreamHeader, count);
+    rs::LazyFlatSet<unsigned> loaded;
+    std::stringstream huge(patch(stream.str(), countOffset, std::uint64_t(1) << 60));
+    CPPUNIT_ASSERT(!loaded.deserialize(huge));
+    CPPUNIT_ASSERT(loaded.empty());
+    
+    std::stringstream larger(patch(stream.str(), countOffset, 1001));
+    CPPUNIT_ASSERT(!loaded.deserialize(larger));
+    
+    std::stringstream intact(stream.str());
+    CPPUNIT_ASSERT(loaded.deserialize(intact, true));
+    CPPUNIT_ASSERT_EQUAL(1000ul, loaded.size());
+    
+    // without seeking the values are read in chunks until the stream runs out
+    UnseekableBuffer hugeBuffer(patch(stream.str(), countOffset, std::uint64_t(1) << 60));
+    std::istream hugeUnseekable(&hugeBuffer);
+    CPPUNIT_ASSERT(!loaded.deserialize(hugeUnseekable));
+    
+    UnseekableBuffer intactBuffer(stream.str());
+    std::istream intactUnseekable(&intactBuffer);
+    CPPUNIT_ASSERT(loaded.deserialize(intactUnseekable, true));
+    CPPUNIT_ASSERT_EQUAL(1000ul, loaded.size());
+    
+    rs::LazyFlatSet<std::string> strings;
+    strings.insert("a");
+    strings.insert("b");
+    std::stringstream stringStream;
+    CPPUNIT_ASSERT(strings.serialize(stringStream));
+    
+    rs::LazyFlatSet<std::string> loadedStrings;
+    std::stringstream hugeCount(patch(stringStream.str(), countOffset, std::uint64_t(1) << 60));
+    CPPUNIT_ASSERT(!loadedStrings.deserialize(hugeCount));
+    std::stringstream hugeLength(patch(stringStream.str(), sizeof(rs::LazyFlatSetStreamHeader), std::uint64_t(1) << 60));
+    CPPUNIT_ASSERT(!loadedStrings.deserialize(hugeLength));
+    CPPUNIT_ASSERT(loadedStrings.empty());
+    
+    UnseekableBuffer hugeLengthBuffer(patch(stringStream.str(), sizeof(rs::LazyFlatSetStreamHeader), std::uint64_t(1) << 60));
+    std::istream hugeLengthUnseekable(&hugeLengthBuffer);
+    CPPUNIT_ASSERT(!loadedStrings.deserialize(hugeLengthUnseekable));
+    
+    std::stringstream intactStrings(stringStream.str());
+    CPPUNIT_ASSERT(loadedStrings.deserialize(intactStrings, true));
+    CPPUNIT_ASSERT_EQUAL(2ul, loadedStrings.size());
+}
+
+struct alignas(64) CacheLine {
+    unsigned key;
+    
+    bool operator<(const CacheLine& other) const { return key < other.key; }
+    bool operator==(const CacheLine& other) const { return key == other.key; }
+};
+
+void basic_operations::test56() {
+    auto resource = rs::LazyFlatSetMemoryResource::default_resource();
+    for (std::size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+        auto p = static_cast<char*>(resource->allocate(100, alignment));
+        CPPUNIT_ASSERT_EQUAL(static_cast<std::uintptr_t>(0), reinterpret_cast<std::uintptr_t>(p) % alignment);
+        std::fill(p, p + 100, 'x');
+        resource->deallocate(p, 100, alignment);
+    }
+    
+    // over aligned values keep their alignment in every tier
+    using Allocator = rs::LazyFlatSetPolymorphicAllocator<CacheLine>;
+    rs::LazyFlatSet<CacheLine, std::less<CacheLine>, std::equal_to<CacheLine>, rs::LazyFlatSetQuickSort<CacheLine, std::less<CacheLine>>, Allocator> set(8, 64);
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.insert(CacheLine{ (i * 7) % 1000 });
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(1000ul, set.size());
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::uintptr_t>(0), reinterpret_cast<std::uintptr_t>(set.data()) % alignof(CacheLine));
+    for (unsigned i = 0; i < 1000; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i, set[i].key);
+    }
+}
+
+void basic_operations::test57() {
+    rs::ConcurrentLazyFlatSet<unsigned> set(8, 64);
+    const unsigned max = 2000;
+    for (unsigned i = 0; i < max; i += 2) {
+        set.insert(i);
+    }
+    set.flush();
+    
+    std::atomic<bool> done(false);
+    std::atomic<unsigned> errors(0);
+    
+    // the writer keeps replacing and retiring states while readers walk them, the even values are
+    // always published and the odd ones come and go
+    std::vector<std::thread> readers;
+    for (unsigned r = 0; r < 3; ++r) {
+        readers.emplace_back([&]() {
+            while (!done) {
+                for (unsigned i = 0; i < max; i += 2) {
+                    unsigned v = 1;
+                    if (!set.find(i, v) || v != i) {
+                        ++errors;
+                    }
+                }
+                if (set.size() < max / 2) {
+                    ++errors;
+                }
+            }
+        });
+    }
+    
+    for (unsigned round = 0; round < 20; ++round) {
+        for (unsigned i = 1; i < max; i += 2) {
+            set.insert(i);
+        }
+        set.publish();
+        for (unsigned i = 1; i < max; i += 20) {
+            set.erase(i);
+        }
+        set.flush();
+        set.erase(max + 1);
+    }
+    
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(0u, errors.load());
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(max - (max / 20)), set.size());
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(21));
+    CPPUNIT_ASSERT_EQUAL(1ul, set.count(23));
+}
+
+void basic_operations::test58() {
+    rs::LazyFlatSet<unsigned> shuffled(4, 8), descending(4, 8), runs(4, 8), lookups(4, 8);
+    shuffled.adaptive(true);
+    descending.adaptive(true);
+    runs.adaptive(true);
+    lookups.adaptive(true);
+    
+    std::srand(58);
+    const unsigned size = 100000;
+    for (unsigned i = 0; i < size; ++i) {
+        const auto k = static_cast<unsigned>(std::rand() % (size * 4)) * 2;
+        shuffled.insert(k);
+        descending.insert((size - i) * 2);
+        runs.insert((i * 64) + ((k / 2) % 1024));
+        
+        // lookups of odd values miss every sorted tier and scan the unsorted values
+        lookups.insert(k);
+        for (unsigned j = 0; j < 8; ++j) {
+            CPPUNIT_ASSERT_EQUAL(0ul, lookups.count(k + 1 + (j * 2)));
+        }
+    }
+    
+    // shuffled and descending values move the whole set at each flush, ascending runs are merged at the end
+    // of it so their tiers can stay small, and lookups that scan the unsorted tier keep it short
+    CPPUNIT_ASSERT(shuffled.max_nursery_entries() > 1000);
+    CPPUNIT_ASSERT(descending.max_unsorted_entries() * 2 > shuffled.max_unsorted_entries());
+    CPPUNIT_ASSERT(runs.max_nursery_entries() * 4 < shuffled.max_nursery_entries());
+    CPPUNIT_ASSERT(lookups.max_unsorted_entries() * 2 < shuffled.max_unsorted_entries());
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(size), descending.size());
+    CPPUNIT_ASSERT_EQUAL(shuffled.size(), lookups.size());
+    CPPUNIT_ASSERT(std::equal(shuffled.cbegin(), shuffled.cend(), lookups.cbegin()));
+}
+
+void basic_operations::test59() {
+    using StatsSet = rs::LazyFlatSet<unsigned, std::less<unsigned>, std::equal_to<unsigned>, rs::LazyFlatSetQuickSort<unsigned, std::less<unsigned>>, 
+        std::allocator<unsigned>, false, rs::LazyFlatSetNoFilter<unsigned>, rs::LazyFlatSetStats>;
+    
+    StatsSet set(4, 64);
+    std::set<unsigned> expected;
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.insert(i * 2);
+        expected.insert(i * 2);
+    }
+    set.data();
+    
+    // the tombstones stay below the nursery size so they are only dropped by the next nursery flush,
+    // which merges the nursery into the main collection in the same pass
+    set.deferred_erase(true);
+    for (unsigned i = 0; i < 40; ++i) {
+        CPPUNIT_ASSERT_EQUAL(1ul, set.erase(i * 10));
+        expected.erase(i * 10);
+    }
+    for (unsigned i = 0; i < 60; ++i) {
+        set.insert((i * 30) + 1);
+        expected.insert((i * 30) + 1);
+    }
+    
+    set.reset_stats();
+    set.data();
+    CPPUNIT_ASSERT_EQUAL(1ul, set.stats().nursery_flushes);
+    CPPUNIT_ASSERT_EQUAL(expected.size(), set.size());
+    CPPUNIT_ASSERT(std::equal(expected.cbegin(), expected.cend(), set.cbegin()));
+    
+    // random erases and inserts leave tombstones anywhere around the merged values, with and without levels
+    for (unsigned levels = 0; levels < 2; ++levels) {
+        rs::LazyFlatSet<unsigned> random(4, 32);
+        random.deferred_erase(true);
+        random.levels(levels);
+        std::set<unsigned> reference;
+        std::srand(59);
+        for (unsigned i = 0; i < 20000; ++i) {
+            const auto k = static_cast<unsigned>(std::rand() % 4000);
+            if (std::rand() % 3 == 0) {
+                CPPUNIT_ASSERT_EQUAL(reference.erase(k), random.erase(k));
+            } else {
+                random.insert(k);
+                reference.insert(k);
+            }
+            
+            if (i % 1000 == 0) {
+                CPPUNIT_ASSERT_EQUAL(reference.size(), random.size());
+                CPPUNIT_ASSERT(std::equal(reference.cbegin(), reference.cend(), random.cbegin()));
+            }
+        }
+    }
+    
+    // values that point at what they hold are never left behind as tombstones
+    rs::LazyFlatSet<std::shared_ptr<unsigned>> pointers;
+    pointers.deferred_erase(true);
+    auto value = std::make_shared<unsigned>(42);
+    pointers.insert(value);
+    pointers.insert(std::make_shared<unsigned>(43));
+    pointers.data();
+    CPPUNIT_ASSERT_EQUAL(1ul, pointers.erase(value));
+    CPPUNIT_ASSERT_EQUAL(1l, value.use_count());
+    CPPUNIT_ASSERT_EQUAL(1ul, pointers.size());
+}
@@ -25,6 +25,45 @@ class basic_operations : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(test18);
     CPPUNIT_TEST(test19);
     CPPUNIT_TEST(test20);
+    CPPUNIT_TEST(test21);
+    CPPUNIT_TEST(test22);
+    CPPUNIT_TEST(test23);
+    CPPUNIT_TEST(test24);
+    CPPUNIT_TEST(test25);
+    CPPUNIT_TEST(test26);
+    CPPUNIT_TEST(test27);
+    CPPUNIT_TEST(test28);
+    CPPUNIT_TEST(test29);
+    CPPUNIT_TEST(test30);
+    CPPUNIT_TEST(test31);
+    CPPUNIT_TEST(test32);
+    CPPUNIT_TEST(test33);
+    CPPUNIT_TEST(test34);
+    CPPUNIT_TEST(test35);
+    CPPUNIT_TEST(test36);
+    CPPUNIT_TEST(test37);
+    CPPUNIT_TEST(test38);
+    CPPUNIT_TEST(test39);
+    CPPUNIT_TEST(test40);
+    CPPUNIT_TEST(test41);
+    CPPUNIT_TEST(test42);
+    CPPUNIT_TEST(test43);
+    CPPUNIT_TEST(test44);
+    CPPUNIT_TEST(test45);
+    CPPUNIT_TEST(test46);
+    CPPUNIT_TEST(test47);
+    CPPUNIT_TEST(test48);
+    CPPUNIT_TEST(test49);
+    CPPUNIT_TEST(test50);
+    CPPUNIT_TEST(test51);
+    CPPUNIT_TEST(test52);
+    CPPUNIT_TEST(test53);
+    CPPUNIT_TEST(test54);
+    CPPUNIT_TEST(test55);
+    CPPUNIT_TEST(test56);
+    CPPUNIT_TEST(test57);
+    CPPUNIT_TEST(test58);
+    CPPUNIT_TEST(test59);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -54,6 +93,45 @@ private:
     void test18();
     void test19();
     void test20();
+    void test21();
+    void test22();
+    void test23();
+    void test24();
+    void test25();
+    void test26();
+    void test27();
+    void test28();
+    void test29();
+    void test30();
+    void test31();
+    void test32();
+    void test33();
+    void test34();
+    void test35();
+    void test36();
+    void test37();
+    void test38();
+    void test39();
+    void test40();
+    void test41();
+    void test42();
+    void test43();
+    void test44();
+    void test45();
+    void test46();
+    void test47();
+    void test48();
+    void test49();
+    void test50();
+    void test51();
+    void test52();
+    void test53();
+    void test54();
+    void test55();
+    void test56();
+    void test57();
+    void test58();
+    void test59();
 };
 
 #endif	/* BASIC_OPERATIONS_H */
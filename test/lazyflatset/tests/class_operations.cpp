@@ -66,6 +66,34 @@ private:
 
 unsigned Test::destructorCount_ = 0;
 
+struct TransparentLess {
+    using is_transparent = void;
+    
+    bool operator()(const Test* x, const Test* y) const {
+        return x->value() < y->value();
+    }
+    
+    bool operator()(const Test* x, unsigned y) const {
+        return x->value() < y;
+    }
+    
+    bool operator()(unsigned x, const Test* y) const {
+        return x < y->value();
+    }
+    
+    bool operator()(const Test& x, const Test& y) const {
+        return x.value() < y.value();
+    }
+    
+    bool operator()(const Test& x, unsigned y) const {
+        return x.value() < y;
+    }
+    
+    bool operator()(unsigned x, const Test& y) const {
+        return x < y.value();
+    }
+};
+
 using LazyFlatSetTest = rs::LazyFlatSet<Test, Test::Less, Test::Equals>;
 using LazyFlatSetTestPtr = rs::LazyFlatSet<Test*, Test::Less, Test::Equals>;
 using LazyFlatSetTestSmartPtr = rs::LazyFlatSet<std::shared_ptr<Test>, Test::Less, Test::Equals>;
@@ -507,4 +535,103 @@ void class_operations::test24() {
         
     CPPUNIT_ASSERT_EQUAL(max, Test::destructorCount_);        
     CPPUNIT_ASSERT_EQUAL(0ul, set.size());
-}
\ No newline at end of file
+}
+void class_operations::test25() {
+    LazyFlatSetTestPtr set(16, 64);
+    set.search_index(true);
+    
+    const unsigned max = 1000;
+    for (unsigned i = 0; i < max; i++) {
+        set.insert(new Test(i));
+    }
+    
+    set.shrink_to_fit();
+    
+    // replace the values in the main collection and free the originals, the index must not hold on to them
+    for (unsigned i = 0; i < max; i++) {
+        Test k(i);
+        auto old = set.find_fn([&](const Test* t) { return i - t->value(); });
+        set.insert(new Test(i));
+        delete old;
+        CPPUNIT_ASSERT_EQUAL(1ul, set.count(&k));
+    }
+    
+    set.shrink_to_fit();
+    for (unsigned i = 0; i < max; i++) {
+        Test k(i);
+        CPPUNIT_ASSERT_EQUAL(1ul, set.count(&k));
+    }
+    
+    set.clear_fn(Test::Erase{});
+    CPPUNIT_ASSERT_EQUAL(0ul, set.size());
+}
+
+void class_operations::test26() {
+    rs::LazyFlatSet<Test*, TransparentLess, Test::Equals> set(16, 64);
+    
+    const unsigned max = 1000;
+    for (unsigned i = 0; i < max; i++) {
+        set.insert(new Test(max - i - 1));
+    }
+    
+    for (unsigned i = 0; i < max; i++) {
+        CPPUNIT_ASSERT_EQUAL(1ul, set.count(i));
+        CPPUNIT_ASSERT(set.contains(i));
+        CPPUNIT_ASSERT_EQUAL(i, set.find(i)->value());
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(0ul, set.count(max));
+    CPPUNIT_ASSERT(!set.contains(max));
+    CPPUNIT_ASSERT(set.find(max) == nullptr);
+    
+    for (unsigned i = 0; i < max; i += 2) {
+        auto value = set.find(i);
+        CPPUNIT_ASSERT_EQUAL(1ul, set.erase(i));
+        CPPUNIT_ASSERT_EQUAL(0ul, set.erase(i));
+        delete value;
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<LazyFlatSetTestPtr::size_type>(max / 2), set.size());
+    
+    set.clear_fn(Test::Erase{});
+    CPPUNIT_ASSERT_EQUAL(max, Test::destructorCount_);
+}
+
+void class_operations::test27() {
+    rs::LazyFlatSet<Test, TransparentLess, Test::Equals> set;
+    set.emplace(42);
+    set.emplace(69);
+    
+    CPPUNIT_ASSERT(set.contains(42u));
+    CPPUNIT_ASSERT(set.contains(Test(69)));
+    CPPUNIT_ASSERT(!set.contains(Test(7)));
+    CPPUNIT_ASSERT_EQUAL(42u, set.find(42u)->value());
+    CPPUNIT_ASSERT_EQUAL(1ul, set.erase(42u));
+    CPPUNIT_ASSERT(!set.contains(42u));
+    CPPUNIT_ASSERT_EQUAL(1ul, set.size());
+    
+    rs::LazyFlatSet<unsigned> plain;
+    plain.insert(42);
+    CPPUNIT_ASSERT(plain.contains(42));
+    CPPUNIT_ASSERT(!plain.contains(69));
+}
+
+void class_operations::test28() {
+    // Test has no default constructor so the merge has to grow the main collection by copying
+    LazyFlatSetTest set(4, 8);
+    for (unsigned i = 0; i < 1000; ++i) {
+        set.emplace(i * 2);
+    }
+    set.data();
+    
+    for (unsigned i = 0; i < 100; ++i) {
+        set.emplace(((i * 337) % 1000) * 2 + 1);
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(1100ul, set.size());
+    for (std::size_t i = 1; i < set.size(); ++i) {
+        CPPUNIT_ASSERT(set[i - 1].value() < set[i].value());
+    }
+    CPPUNIT_ASSERT(set.contains(Test(1)));
+    CPPUNIT_ASSERT(!set.contains(Test(2001)));
+}
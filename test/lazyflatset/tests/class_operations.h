@@ -30,6 +30,10 @@ class class_operations : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(test22);
     CPPUNIT_TEST(test23);
     CPPUNIT_TEST(test24);
+    CPPUNIT_TEST(test25);
+    CPPUNIT_TEST(test26);
+    CPPUNIT_TEST(test27);
+    CPPUNIT_TEST(test28);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -64,6 +68,10 @@ private:
     void test22();
     void test23();
     void test24();
+    void test25();
+    void test26();
+    void test27();
+    void test28();
 };
 
 #endif	/* CLASS_OPERATIONS_H */
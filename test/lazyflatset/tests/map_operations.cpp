@@ -0,0 +1,159 @@
+#include "map_operations.h"
+
+#include "../../../lazyflatset.hpp"
+
+#include <string>
+#include <algorithm>
+
+CPPUNIT_TEST_SUITE_REGISTRATION(map_operations);
+
+using LazyFlatMapUnsigned = rs::LazyFlatMap<unsigned, std::string>;
+
+map_operations::map_operations() {
+}
+
+map_operations::~map_operations() {
+}
+
+void map_operations::setUp() {
+}
+
+void map_operations::tearDown() {
+}
+
+void map_operations::test1() {
+    LazyFlatMapUnsigned map;
+    CPPUNIT_ASSERT(map.empty());
+    CPPUNIT_ASSERT_EQUAL(0ul, map.size());
+    
+    map[42] = "hello";
+    CPPUNIT_ASSERT(!map.empty());
+    CPPUNIT_ASSERT_EQUAL(1ul, map.size());
+    CPPUNIT_ASSERT_EQUAL(1ul, map.count(42));
+    CPPUNIT_ASSERT_EQUAL(0ul, map.count(69));
+    CPPUNIT_ASSERT_EQUAL(std::string("hello"), map[42]);
+    
+    map.clear();
+    CPPUNIT_ASSERT(map.empty());
+    CPPUNIT_ASSERT_EQUAL(0ul, map.count(42));
+}
+
+void map_operations::test2() {
+    LazyFlatMapUnsigned map;
+    const unsigned max = 10000;
+    for (unsigned i = 0; i < max; ++i) {
+        map[i] = std::to_string(i);
+        CPPUNIT_ASSERT_EQUAL(static_cast<LazyFlatMapUnsigned::size_type>(i + 1), map.size());
+    }
+    
+    for (unsigned i = 0; i < max; ++i) {
+        CPPUNIT_ASSERT_EQUAL(std::to_string(i), *map.find(i));
+    }
+    
+    auto keys = map.keys();
+    auto values = map.values();
+    for (unsigned i = 0; i < max; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i, keys[i]);
+        CPPUNIT_ASSERT_EQUAL(std::to_string(i), values[i]);
+    }
+}
+
+void map_operations::test3() {
+    LazyFlatMapUnsigned map;
+    const unsigned max = 10000;
+    for (unsigned i = 0; i < max; ++i) {
+        auto k = max - i - 1;
+        map[k] = std::to_string(k);
+        CPPUNIT_ASSERT_EQUAL(1ul, map.count(k));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<LazyFlatMapUnsigned::size_type>(max), map.size());
+    
+    auto keys = map.keys();
+    auto values = map.values();
+    for (unsigned i = 0; i < max; ++i) {
+        CPPUNIT_ASSERT_EQUAL(i, keys[i]);
+        CPPUNIT_ASSERT_EQUAL(std::to_string(i), values[i]);
+    }
+}
+
+void map_operations::test4() {
+    LazyFlatMapUnsigned map;
+    
+    auto result = map.try_emplace(42, "hello");
+    CPPUNIT_ASSERT(result.second);
+    CPPUNIT_ASSERT_EQUAL(std::string("hello"), *result.first);
+    
+    result = map.try_emplace(42, "world");
+    CPPUNIT_ASSERT(!result.second);
+    CPPUNIT_ASSERT_EQUAL(std::string("hello"), *result.first);
+    
+    result = map.insert_or_assign(42, std::string("world"));
+    CPPUNIT_ASSERT(!result.second);
+    CPPUNIT_ASSERT_EQUAL(std::string("world"), *result.first);
+    
+    result = map.insert_or_assign(69, std::string("again"));
+    CPPUNIT_ASSERT(result.second);
+    CPPUNIT_ASSERT_EQUAL(2ul, map.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("world"), map[42]);
+    CPPUNIT_ASSERT_EQUAL(std::string("again"), map[69]);
+}
+
+void map_operations::test5() {
+    LazyFlatMapUnsigned map(4, 16);
+    const unsigned max = 1000;
+    for (unsigned i = 0; i < max; ++i) {
+        map[(i * 7919) % max] = "x";
+    }
+    
+    for (unsigned i = 0; i < max; ++i) {
+        map.find(i)->append(std::to_string(i));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<LazyFlatMapUnsigned::size_type>(max), map.size());
+    
+    unsigned next = 0;
+    map.for_each([&](const unsigned& k, std::string& v) {
+        CPPUNIT_ASSERT_EQUAL(next, k);
+        CPPUNIT_ASSERT_EQUAL("x" + std::to_string(k), v);
+        ++next;
+    });
+    
+    CPPUNIT_ASSERT_EQUAL(max, next);
+}
+
+void map_operations::test6() {
+    LazyFlatMapUnsigned map(4, 16);
+    const unsigned max = 1000;
+    for (unsigned i = 0; i < max; ++i) {
+        map[(i * 7919) % max] = std::to_string(i);
+    }
+    
+    for (unsigned i = 0; i < max; i += 2) {
+        CPPUNIT_ASSERT_EQUAL(1ul, map.erase(i));
+        CPPUNIT_ASSERT_EQUAL(0ul, map.erase(i));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(static_cast<LazyFlatMapUnsigned::size_type>(max / 2), map.size());
+    
+    for (unsigned i = 0; i < max; ++i) {
+        CPPUNIT_ASSERT_EQUAL(static_cast<LazyFlatMapUnsigned::size_type>(i % 2), map.count(i));
+    }
+}
+
+void map_operations::test7() {
+    rs::LazyFlatMap<std::string, unsigned> map;
+    const unsigned max = 1000;
+    for (unsigned i = 0; i < max; ++i) {
+        ++map[std::to_string(i % 100)];
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(100ul, map.size());
+    
+    for (unsigned i = 0; i < 100; ++i) {
+        CPPUNIT_ASSERT_EQUAL(10u, map[std::to_string(i)]);
+    }
+    
+    auto keys = map.keys();
+    CPPUNIT_ASSERT(std::is_sorted(keys, keys + map.size()));
+}
@@ -0,0 +1,36 @@
+#ifndef MAP_OPERATIONS_H
+#define	MAP_OPERATIONS_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class map_operations : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(map_operations);
+
+    CPPUNIT_TEST(test1);
+    CPPUNIT_TEST(test2);
+    CPPUNIT_TEST(test3);
+    CPPUNIT_TEST(test4);
+    CPPUNIT_TEST(test5);
+    CPPUNIT_TEST(test6);
+    CPPUNIT_TEST(test7);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    map_operations();
+    virtual ~map_operations();
+    void setUp();
+    void tearDown();
+
+private:
+    void test1();
+    void test2();
+    void test3();
+    void test4();
+    void test5();
+    void test6();
+    void test7();
+};
+
+#endif	/* MAP_OPERATIONS_H */
+